@@ -8,6 +8,9 @@ DUMP_DICT_META_MN_BIN = $(LDA_ROOT)/bin
 GENERATE_DATABLOCKS = $(LDA_ROOT)/src/generate_datablocks
 GENERATE_DATABLOCKS_BIN = $(LDA_ROOT)/bin
 
+# queue_bench
+QUEUE_BENCH = $(LDA_ROOT)/src/queue_bench
+QUEUE_BENCH_BIN = $(LDA_ROOT)/bin
 
 # light lda
 LIGHT_LDA = $(LDA_ROOT)/src/light_lda
@@ -18,6 +18,12 @@ def generate_from_dir(params):
     params_local['datablocks_dir'] = params['datablocks_dir']
     params_local['block_size'] = params['block_size']
     params_local['mean_doc_size'] = params['mean_doc_size']
+    params_local['num_threads'] = params['preprocess_threads']
+    params_local['input_format'] = params['input_format']
+    params_local['vocab_memory_budget'] = params['vocab_memory_budget']
+    params_local['word_id_by_frequency'] = params['word_id_by_frequency']
+    params_local['cluster_docs'] = params['cluster_docs']
+    params_local['append'] = params['append']
     progname = 'generate_datablocks'
     app_dir = params['app_dir']
     prog_path = os.path.join(app_dir, 'bin', progname)
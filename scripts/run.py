@@ -104,9 +104,7 @@ def run(params):
 
     # Spawn program instances
     block_files = [filename for filename in glob.glob(os.path.join(params['datablocks_dir'],'block*'))]
-    block_sizes = [os.path.getsize(filename) for filename in block_files]
     num_blocks = len(block_files)
-    max_block_size = max(block_sizes)
     ave_block_num = num_blocks / num_hosts
 
     doc_file = os.path.join(params['datablocks_dir'], 'block')
@@ -119,7 +117,20 @@ def run(params):
     params_run['num_delta_threads'] = params['num_delta_threads']
     params_run['cold_start'] = params['cold_start']
     params_run['staleness'] = params['staleness']
+    params_run['delta_aggregation'] = params['delta_aggregation']
+    params_run['delta_radix_merge'] = params['delta_radix_merge']
+    params_run['delta_balanced_shard'] = params['delta_balanced_shard']
+    params_run['delta_parallel_send'] = params['delta_parallel_send']
+    params_run['delta_double_buffer'] = params['delta_double_buffer']
     params_run['num_blocks'] = num_blocks
+    params_run['data_block_mmap'] = params['data_block_mmap']
+    params_run['data_block_compress'] = params['data_block_compress']
+    params_run['data_io_threads'] = params['data_io_threads']
+    params_run['data_prefetch_depth'] = params['data_prefetch_depth']
+    params_run['data_direct_io'] = params['data_direct_io']
+    params_run['doc_work_stealing'] = params['doc_work_stealing']
+    params_run['data_cache_budget'] = params['data_cache_budget']
+    params_run['slice_meta_cache'] = params['slice_meta_cache']
     params_run['doc_file'] = doc_file
     params_run['vocab_file'] = vocab_file
     params_run['dump_file'] = params['dump_file']
@@ -133,12 +144,12 @@ def run(params):
     params_run['dump_model_interval'] = params['dump_model_interval']
     params_run['compute_ll_interval'] = params['compute_ll_interval']
 
-    params_run['block_size'] = int(params['block_size']) + 1
-    params_run['block_max_capacity'] = max_block_size
     params_run['alias_max_capacity'] = params['alias_max_capacity']
     params_run['delta_max_capacity'] = params['delta_max_capacity']
     params_run['model_max_capacity'] = params['model_max_capacity']
     params_run['load_factor'] = params['load_factor']
+    params_run['delta_array_capacity'] = params['delta_array_capacity']
+    params_run['delta_pool_budget'] = params['delta_pool_budget']
 
     print('Spawning program instances')
     client_id = 0
@@ -8,14 +8,26 @@
 #include <stdint.h>
 #include <chrono>
 #include <algorithm>
-#include <set>
-#include <map>
-#include <tuple>
+#include <atomic>
+#include <queue>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
-#include <boost/progress.hpp>
-#include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
 #include <glog/logging.h>
 #include <gflags/gflags.h>
 
@@ -27,47 +39,62 @@ Input file format:
 3, it is possible to have empty doc, which is represented only by its label
 4, the maximum length of input doc can not exceed 10000000
 
-Output file format:
-1, the first 4 byte indicates the number of docs in this block
-2, the 4 * (doc_num + 1) bytes indicate the offset of reach doc
+Output file format (split format, the word ids and topics are stored in
+separate arrays so that the trainer only rewrites the topics):
+1, the first 4 byte is kSplitBlockTag (-2)
+2, the next 4 byte indicates the number of docs in this block
+3, the 8 * (doc_num + 1) bytes indicate the token offset of each doc
+4, the word ids of all the tokens, then the topics of all the tokens
 an example
+-2   // split format
 3    // there are 3 docs in this block
 0    // the offset of the 1-st doc
-11   // the offset of the 2-nd doc, with this we know the length of the 1-st doc is 5 = 10/2
-18   // the offset of the 3-rd doc, with this we know the length of the 2-nd doc is 3 = (16-10)/2 
-27   // with this, we know the length of the 3-rd doc is 4 = (24 - 16)/2
-idx w11 t11 w12 t12 w13 t13 w14 t14 w15 t15     // the token-topic list of the 1-st doc
-idx w21 t21 w22 t22 w23 t23                     // the token-topic list of the 2-nd doc
-idx w31 t31 w32 t32 w33 t33 w34 t34             // the token-topic list of the 3-rd doc
+5    // the offset of the 2-nd doc, with this we know the length of the 1-st doc is 5
+8    // the offset of the 3-rd doc, with this we know the length of the 2-nd doc is 3
+12   // with this, we know the length of the 3-rd doc is 4
+w11 w12 w13 w14 w15 w21 w22 w23 w31 w32 w33 w34  // the word ids
+t11 t12 t13 t14 t15 t21 t22 t23 t31 t32 t33 t34  // the topics
+
+The documents are processed in two passes over the input files, both split
+across num_threads threads: counting the term and document frequency of
+each word, then converting the documents of a block to sorted word ids
+while a writer thread dumps the previous block. With cluster_docs, the first
+pass also sketches the words of each document, and the documents are
+blocked in MinHash order instead of input order.
+
+With append, the documents are added to the blocks of datablocks_dir: the
+words of its word_tf.txt keep their ids and the new words follow, the new
+documents go to new blocks with unassigned topics (kUnassignedTopic), and
+the global tf in word_tf.txt and in the vocab files of the existing blocks
+is updated. The trainer then warm starts with cold_start=false.
 */
 
-struct Token {
-	int32_t word_id;
-	int32_t topic_id;
-};
-
-int Compare(const Token& token1, const Token& token2) {
-	return token1.word_id < token2.word_id;
-}
+// First int32 of a block file in the split format, see memory/data_block.h
+const int32_t kSplitBlockTag = -2;
+// Topic of the tokens of appended docs, see memory/data_block.h
+const int32_t kUnassignedTopic = -1;
+// Tokens kept per doc, the trainer does not sample beyond
+// LDADocument::kMaxSizeLightHash
+const int32_t kMaxDocSize = 512;
+// Docs a thread takes at a time
+const int32_t kDocChunkSize = 64;
 
 DEFINE_int64(block_size, 1000000, "the maximum number of docs in each block");
 DEFINE_int64(mean_doc_size, 100, "the average number of tokens in each doc");
 DEFINE_int32(file_offset, 0, "The offset of the output file name");
 DEFINE_string(datablocks_dir, "", "");
 DEFINE_string(input_dir, "", "");
+DEFINE_string(input_format, "dir", "dir: one text file per doc in input_dir; libsvm: one doc per line, \"label<TAB>id[:count] id[:count] ...\", in input_file or the files of input_dir");
+DEFINE_string(input_file, "", "comma separated input files for input_format=libsvm");
 DEFINE_string(vocab_stopword, "", "");
 DEFINE_int32(vocab_min_occurence, 0, "");
+DEFINE_bool(word_id_by_frequency, false, "number the words by descending global tf, so that the dense model rows come first, instead of randomly (input_format=dir) or as given (input_format=libsvm)");
+DEFINE_bool(cluster_docs, false, "order the docs by the MinHash of their words, so that docs sharing words go to the same blocks and the blocks have smaller vocabularies");
+DEFINE_bool(append, false, "add the docs to the data blocks and vocabulary already in datablocks_dir");
+DEFINE_int64(vocab_memory_budget, 0, "memory budget in MB for counting the words of input_format=dir, beyond which the counts are spilled to sorted runs in datablocks_dir and merged. 0 means counting in memory");
+DEFINE_int32(num_threads, 0, "number of threads reading and tokenizing the documents, 0 means one per core");
 
-int64_t buf_idx_;
-int64_t buf_size_;
-
-int64_t *offset_buf_;      // size: FLAGS_block_size + 1
-int32_t *block_buf_;       // size: buf_size
-
-const int kMaxVocabSize = 50000000;
-const int kMaxTokenNum = 2000000;
-// std::map<int32_t, int32_t> global_tf_map;
-std::vector<int32_t> global_tf_map(kMaxVocabSize, 0);
+int32_t num_threads_;
 
 
 double get_time()
@@ -77,6 +104,283 @@ double get_time()
 	return std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1, 1>>>(since_epoch).count();
 }
 
+// Open addressing hash map from word to Value. The words are kept in one
+// character arena, so a lookup does not allocate.
+template <typename Value>
+class FlatDict
+{
+public:
+	explicit FlatDict(int64_t capacity = 1024) : size_(0)
+	{
+		int64_t num_slots = 16;
+		while (num_slots < 2 * capacity) num_slots <<= 1;
+		slots_.resize(num_slots);
+		values_.resize(num_slots);
+	}
+
+	static uint64_t Hash(const char* word, int32_t length)
+	{
+		uint64_t hash = 14695981039346656037ULL; // FNV-1a
+		for (int32_t i = 0; i < length; ++i)
+		{
+			hash ^= static_cast<unsigned char>(word[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// Returns the value of word, inserted as Value() if missing.
+	Value& Insert(const char* word, int32_t length, uint64_t hash)
+	{
+		if (2 * (size_ + 1) > static_cast<int64_t>(slots_.size())) Grow();
+		int64_t index = Probe(word, length, hash);
+		Slot& slot = slots_[index];
+		if (slot.offset == -1)
+		{
+			slot.offset = arena_.size();
+			slot.length = length;
+			slot.hash = hash;
+			arena_.insert(arena_.end(), word, word + length);
+			values_[index] = Value();
+			++size_;
+		}
+		return values_[index];
+	}
+
+	Value& Insert(const char* word, int32_t length) { return Insert(word, length, Hash(word, length)); }
+
+	// Returns nullptr if word is missing.
+	const Value* Find(const char* word, int32_t length, uint64_t hash) const
+	{
+		int64_t index = Probe(word, length, hash);
+		return slots_[index].offset == -1 ? nullptr : &values_[index];
+	}
+
+	Value* Find(const char* word, int32_t length, uint64_t hash)
+	{
+		int64_t index = Probe(word, length, hash);
+		return slots_[index].offset == -1 ? nullptr : &values_[index];
+	}
+
+	const Value* Find(const char* word, int32_t length) const { return Find(word, length, Hash(word, length)); }
+
+	int64_t Size() const { return size_; }
+
+	// Bytes of memory held by the map.
+	int64_t MemorySize() const
+	{
+		return static_cast<int64_t>(slots_.size()) * (sizeof(Slot) + sizeof(Value)) + arena_.capacity();
+	}
+
+	// Calls func(word, length, hash, value) for every word. The word pointers
+	// stay valid until the next insert.
+	template <typename Func>
+	void ForEach(Func func)
+	{
+		for (int64_t i = 0; i < static_cast<int64_t>(slots_.size()); ++i)
+		{
+			if (slots_[i].offset != -1)
+				func(arena_.data() + slots_[i].offset, slots_[i].length, slots_[i].hash, values_[i]);
+		}
+	}
+
+private:
+	struct Slot
+	{
+		Slot() : offset(-1), length(0), hash(0) {}
+		int64_t offset; // in arena_, -1 for an empty slot
+		int32_t length;
+		uint64_t hash;
+	};
+
+	int64_t Probe(const char* word, int32_t length, uint64_t hash) const
+	{
+		int64_t mask = slots_.size() - 1;
+		for (int64_t index = hash & mask;; index = (index + 1) & mask)
+		{
+			const Slot& slot = slots_[index];
+			if (slot.offset == -1) return index;
+			if (slot.hash == hash && slot.length == length &&
+				memcmp(arena_.data() + slot.offset, word, length) == 0)
+				return index;
+		}
+	}
+
+	void Grow()
+	{
+		std::vector<Slot> slots(2 * slots_.size());
+		std::vector<Value> values(2 * slots_.size());
+		int64_t mask = slots.size() - 1;
+		for (int64_t i = 0; i < static_cast<int64_t>(slots_.size()); ++i)
+		{
+			if (slots_[i].offset == -1) continue;
+			int64_t index = slots_[i].hash & mask;
+			while (slots[index].offset != -1) index = (index + 1) & mask;
+			slots[index] = slots_[i];
+			values[index] = values_[i];
+		}
+		slots_.swap(slots);
+		values_.swap(values);
+	}
+
+	std::vector<Slot> slots_;
+	std::vector<Value> values_;
+	std::vector<char> arena_;
+	int64_t size_;
+};
+
+struct TermCount
+{
+	TermCount() : tf(0), df(0), last_doc(-1), id(-1) {}
+	int32_t tf;
+	int32_t df;
+	int32_t last_doc; // last doc counted in df
+	int32_t id;       // word id, -1 if not in the vocabulary
+};
+
+// The words are partitioned by hash across the threads, so that the
+// counts of the threads are merged in parallel.
+typedef std::vector<FlatDict<TermCount>> Dictionary;
+
+inline int32_t partition_of(uint64_t hash)
+{
+	return static_cast<int32_t>((hash >> 32) % num_threads_);
+}
+
+// Runs func(thread_id) on num_threads_ threads.
+template <typename Func>
+void parallel_run(Func func)
+{
+	std::vector<std::thread> threads;
+	for (int32_t thread_id = 0; thread_id < num_threads_; ++thread_id)
+		threads.emplace_back(func, thread_id);
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// Bottom-k sketches of the words of the docs: the kSketchSize smallest
+// 32-bit hashes of the distinct words of each doc. Given the hashes of the
+// vocabulary words, the first two sketched words in the vocabulary are the
+// two smallest MinHash values of the doc, and sorting by them puts docs
+// sharing words next to each other.
+class DocSketches
+{
+public:
+	static const int32_t kSketchSize = 4;
+
+	int64_t NumDocs() const { return static_cast<int64_t>(hashes_.size()) / kSketchSize; }
+
+	void Resize(int64_t num_docs) { hashes_.assign(num_docs * kSketchSize, kNoHash); }
+
+	// Adds an empty sketch, returns its doc.
+	int64_t AddDoc()
+	{
+		hashes_.resize(hashes_.size() + kSketchSize, kNoHash);
+		return NumDocs() - 1;
+	}
+
+	// Adds a word hash to the sketch of doc, a doc is sketched by one thread.
+	void Add(int64_t doc, uint32_t hash)
+	{
+		uint32_t* sketch = &hashes_[doc * kSketchSize];
+		if (hash >= sketch[kSketchSize - 1]) return;
+		int32_t i = kSketchSize - 1;
+		for (; i > 0 && sketch[i - 1] >= hash; --i)
+		{
+			if (sketch[i - 1] == hash) return;
+		}
+		std::copy_backward(sketch + i, sketch + kSketchSize - 1, sketch + kSketchSize);
+		sketch[i] = hash;
+	}
+
+	void Append(const DocSketches &other)
+	{
+		hashes_.insert(hashes_.end(), other.hashes_.begin(), other.hashes_.end());
+	}
+
+	// The docs in MinHash order. vocab_hashes: the sorted hashes of the
+	// vocabulary words. The docs without a sketched vocabulary word go last.
+	std::vector<int64_t> Order(const std::vector<uint32_t> &vocab_hashes) const
+	{
+		int64_t num_docs = NumDocs();
+		std::vector<uint64_t> keys(num_docs);
+		parallel_run([&](int32_t thread_id) {
+			int64_t end = num_docs * (thread_id + 1) / num_threads_;
+			for (int64_t doc = num_docs * thread_id / num_threads_; doc < end; ++doc)
+			{
+				const uint32_t* sketch = &hashes_[doc * kSketchSize];
+				uint32_t min_hash[2] = { kNoHash, kNoHash };
+				int32_t found = 0;
+				for (int32_t k = 0; k < kSketchSize && found < 2 && sketch[k] != kNoHash; ++k)
+				{
+					if (std::binary_search(vocab_hashes.begin(), vocab_hashes.end(), sketch[k]))
+						min_hash[found++] = sketch[k];
+				}
+				keys[doc] = (static_cast<uint64_t>(min_hash[0]) << 32) | min_hash[1];
+			}
+		});
+		std::vector<int64_t> order(num_docs);
+		for (int64_t doc = 0; doc < num_docs; ++doc) order[doc] = doc;
+		std::stable_sort(order.begin(), order.end(), [&](int64_t doc1, int64_t doc2) {
+			return keys[doc1] < keys[doc2];
+		});
+		return order;
+	}
+
+private:
+	static const uint32_t kNoHash = 0xffffffffu;
+
+	std::vector<uint32_t> hashes_;
+};
+
+const int32_t DocSketches::kSketchSize;
+const uint32_t DocSketches::kNoHash;
+
+// The 32-bit sketch hash of a word hash
+inline uint32_t sketch_hash(uint64_t hash)
+{
+	return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+// The 64-bit hash of a word id, the splitmix64 finalizer
+inline uint64_t id_hash(uint64_t id)
+{
+	id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+	return id ^ (id >> 31);
+}
+
+void read_file(const std::string& filename, std::string& text)
+{
+	std::ifstream input_file(filename, std::ios::in | std::ios::binary);
+	CHECK(input_file.good()) << "Fails to open file: " << filename;
+	input_file.seekg(0, std::ios::end);
+	text.resize(static_cast<size_t>(input_file.tellg()));
+	input_file.seekg(0, std::ios::beg);
+	input_file.read(&text[0], text.size());
+	input_file.close();
+}
+
+// Calls func(token, length) for the lower-cased tokens of text, split at
+// spaces and punctuation like boost::tokenizer<>. Stops once func returns
+// false.
+template <typename Func>
+void tokenize(const std::string& text, std::string& token, Func func)
+{
+	size_t i = 0;
+	while (i < text.size())
+	{
+		while (i < text.size() && (isspace(static_cast<unsigned char>(text[i])) ||
+			ispunct(static_cast<unsigned char>(text[i]))))
+			++i;
+		token.clear();
+		while (i < text.size() && !isspace(static_cast<unsigned char>(text[i])) &&
+			!ispunct(static_cast<unsigned char>(text[i])))
+			token.push_back(static_cast<char>(tolower(static_cast<unsigned char>(text[i++]))));
+		if (!token.empty() && !func(token.data(), static_cast<int32_t>(token.size())))
+			return;
+	}
+}
 
 void count_doc_num(std::string input_doc, int64_t &doc_num)
 {
@@ -114,183 +418,596 @@ void calc_block_num(int64_t doc_num, int32_t block_size, int32_t &block_num, std
 	}
 }
 
-void dump_blocks(std::vector<std::string> &filenames, std::map<std::string, int32_t> &word_to_id,
-        std::string output_dir, int32_t block_num, std::vector<int32_t> &blocks_size)
+// The sorted word ids of the docs of one block
+struct BlockDocs
 {
-	const char* line = NULL;
-	char *endptr = NULL;
-	const int kBASE = 10;
+	int32_t block_id;
+	int32_t num_docs;
+	std::vector<std::vector<int32_t>> docs; // reused across blocks
+};
 
-	int64_t total_token = 0;
+// Converts the docs [doc_begin, doc_begin + num_docs) to sorted word ids.
+void tokenize_block(std::vector<std::string> &filenames, Dictionary &dictionary,
+	int64_t doc_begin, BlockDocs &block)
+{
+	if (static_cast<int32_t>(block.docs.size()) < block.num_docs) block.docs.resize(block.num_docs);
+	std::atomic<int32_t> next_doc(0);
+	parallel_run([&](int32_t thread_id) {
+		std::string text, token;
+		for (int32_t begin = next_doc.fetch_add(kDocChunkSize); begin < block.num_docs;
+			begin = next_doc.fetch_add(kDocChunkSize))
+		{
+			int32_t end = std::min(begin + kDocChunkSize, block.num_docs);
+			for (int32_t j = begin; j < end; ++j)
+			{
+				std::vector<int32_t>& doc = block.docs[j];
+				doc.clear();
+				read_file(filenames[doc_begin + j], text);
+				tokenize(text, token, [&](const char* word, int32_t length) {
+					uint64_t hash = FlatDict<TermCount>::Hash(word, length);
+					const TermCount* count = dictionary[partition_of(hash)].Find(word, length, hash);
+					if (count != nullptr && count->id != -1) doc.push_back(count->id);
+					return static_cast<int32_t>(doc.size()) < kMaxDocSize;
+				});
+				std::sort(doc.begin(), doc.end());
+			}
+		}
+	});
+}
 
-	int doc_buf_idx;
-	int32_t *block_buf;
+// Writes the block and vocab files of a block. Used by one thread at a
+// time, its buffers are reused for every block.
+class BlockWriter
+{
+public:
+	// initial_topic: the topic written for every token
+	BlockWriter(const std::vector<int32_t> &global_tf, int64_t buf_size, int32_t initial_topic) :
+		global_tf_(global_tf), local_tf_(global_tf.size(), 0), buf_size_(buf_size),
+		initial_topic_(initial_topic), total_token_(0)
+	{
+		block_buf_.resize(buf_size_);
+	}
+
+	void Write(const BlockDocs &block, const std::string &output_dir);
+
+	int64_t TotalToken() const { return total_token_; }
+
+private:
+	const std::vector<int32_t> &global_tf_;
+	std::vector<int32_t> local_tf_;   // zero but for the words of the block being written
+	std::vector<int32_t> local_words_;
+	std::vector<int64_t> offset_buf_;
+	std::vector<int32_t> block_buf_;
+	int64_t buf_size_;
+	int32_t initial_topic_;
+	int64_t total_token_;
+};
 
-	block_buf = new int32_t[kMaxTokenNum];
-	int32_t cursor = 0;
-    int32_t doc_idx = 0;
-	for (int i = 0; i < block_num; ++i)
+void BlockWriter::Write(const BlockDocs &block, const std::string &output_dir)
+{
+	int32_t i = block.block_id;
+	std::cout << "Start dumping block# " << i + FLAGS_file_offset << std::endl;
+
+	std::string block_name = output_dir + "/block." + std::to_string(i + FLAGS_file_offset);
+	std::string vocab_name = output_dir + "/vocab." + std::to_string(i + FLAGS_file_offset);
+	std::string txt_vocab_name = output_dir + "/vocab." + std::to_string(i + FLAGS_file_offset) + ".txt";
+
+	std::ofstream block_file(block_name, std::ios::out | std::ios::binary);
+	std::ofstream vocab_file(vocab_name, std::ios::out | std::ios::binary);
+	std::ofstream txt_vocab_file(txt_vocab_name, std::ios::out);
+
+	CHECK(block_file.good()) << "Fails to create file: " << block_name;
+	CHECK(vocab_file.good()) << "Fails to create file: " << vocab_name;
+	CHECK(txt_vocab_file.good()) << "Fails to create file: " << txt_vocab_name;
+
+	int32_t block_size = block.num_docs;
+	offset_buf_.assign(block_size + 1, 0);
+	for (int32_t j = 0; j < block_size; ++j)
+		offset_buf_[j + 1] = offset_buf_[j] + block.docs[j].size();
+	int64_t block_token_num = offset_buf_[block_size];
+
+	// write the format tag, the number of docs and the token offset of
+	// each doc in this block
+	block_file.write(reinterpret_cast<const char*> (&kSplitBlockTag), sizeof(int32_t));
+	block_file.write(reinterpret_cast<char*> (&block_size), sizeof(int32_t));
+	block_file.write(reinterpret_cast<char*> (offset_buf_.data()), sizeof(int64_t)* (block_size + 1));
+
+	// write the word ids, counting the local tf
+	local_words_.clear();
+	int64_t buf_idx = 0;
+	for (int32_t j = 0; j < block_size; ++j)
+	{
+		const std::vector<int32_t>& doc = block.docs[j];
+		for (int32_t word_id : doc)
+		{
+			if (local_tf_[word_id]++ == 0) local_words_.push_back(word_id);
+		}
+		if (buf_idx + static_cast<int64_t>(doc.size()) > buf_size_)
+		{
+			block_file.write(reinterpret_cast<char*> (block_buf_.data()), sizeof(int32_t)* buf_idx);
+			buf_idx = 0;
+		}
+		if (static_cast<int64_t>(doc.size()) > buf_size_)
+		{
+			block_file.write(reinterpret_cast<const char*> (doc.data()), sizeof(int32_t)* doc.size());
+			continue;
+		}
+		std::copy(doc.begin(), doc.end(), block_buf_.begin() + buf_idx);
+		buf_idx += doc.size();
+	}
+	if (buf_idx != 0)
 	{
-		std::cout << "Start dumping block# " << i + FLAGS_file_offset << std::endl;
+		block_file.write(reinterpret_cast<char*> (block_buf_.data()), sizeof(int32_t)* buf_idx);
+	}
 
-		std::string block_name = output_dir + "/block." + std::to_string(i + FLAGS_file_offset);
-		std::string vocab_name = output_dir + "/vocab." + std::to_string(i + FLAGS_file_offset);
-		std::string txt_vocab_name = output_dir + "/vocab." + std::to_string(i + FLAGS_file_offset) + ".txt";
-		
-		std::ofstream block_file(block_name, std::ios::out | std::ios::binary);
-		std::ofstream vocab_file(vocab_name, std::ios::out | std::ios::binary);
-		std::ofstream txt_vocab_file(txt_vocab_name, std::ios::out);
+	// write the topics, all initialized to initial_topic_
+	std::fill(block_buf_.begin(), block_buf_.end(), initial_topic_);
+	for (int64_t num_topic = block_token_num; num_topic > 0; num_topic -= buf_size_)
+	{
+		block_file.write(reinterpret_cast<char*> (block_buf_.data()), sizeof(int32_t)* std::min(num_topic, buf_size_));
+	}
+	CHECK(block_file.good()) << "Fails to write file: " << block_name;
+	block_file.close();
+	total_token_ += block_token_num;
 
-		CHECK(block_file.good()) << "Fails to create file: " << block_name;
-		CHECK(vocab_file.good()) << "Fails to create file: " << vocab_name;
-		CHECK(txt_vocab_file.good()) << "Fails to create file: " << txt_vocab_name;
+	std::sort(local_words_.begin(), local_words_.end());
+	int32_t non_zero_count = static_cast<int32_t>(local_words_.size());
 
-		// std::map<int32_t, int32_t> local_vocabs;
-		std::vector<int32_t> local_vocabs(kMaxVocabSize, 0);
-		int block_size = blocks_size[i];
-
-		std::string str_line;
-
-		memset(offset_buf_, 0, sizeof(int64_t)* (block_size + 1));
-
-		// write the number of docs in this block
-		block_file.write(reinterpret_cast<char*> (&block_size), sizeof(int32_t));
-
-		// write the length of each doc in this block
-		block_file.write(reinterpret_cast<char*> (offset_buf_), sizeof(int64_t)* (block_size + 1));
-
-		int64_t block_token_num = 0;
-
-		buf_idx_ = 0;
-		for (int j = 0; j < block_size; ++j)
-		{			
-			int doc_count = 0;
-			std::vector<Token> doc_tokens;
-            std::string filename = filenames[doc_idx++];
-	        std::ifstream input_file(filename, std::ios::in);
-	        CHECK(input_file.good()) << "Fails to open file: " << filename;
-            std::string str_line;
-            bool exceed_flag = false;
-            while (getline(input_file, str_line) && !exceed_flag) {
-		        if (!str_line.empty()) {
-                    boost::tokenizer<> tok(str_line);
-                    for (boost::tokenizer<>::iterator itr=tok.begin(); itr!=tok.end(); ++itr) {
-                        std::string token = *itr;
-                        std::transform(token.begin(), token.end(), token.begin(), ::tolower);
-                        std::map<std::string, int32_t>::iterator it = word_to_id.find(token);
-                        if (it != word_to_id.end()) {
-                            int32_t word_id = it->second;
-				            doc_tokens.push_back({ word_id, 0 });
-				            ++local_vocabs[word_id];
-				            ++block_token_num;
-				            ++doc_count;
-				            if (doc_count >= 512) {
-                                exceed_flag = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            input_file.close();
-
-			doc_buf_idx = 0;
-
-			std::sort(doc_tokens.begin(), doc_tokens.end(), Compare);
-
-			block_buf[doc_buf_idx++] = 0; // cursor
-			
-			for (auto& token : doc_tokens) 
-			{
-				block_buf[doc_buf_idx++] = token.word_id;
-				block_buf[doc_buf_idx++] = token.topic_id;
-			}
+	// write vocab: the number of words, the word ids, the global tf, then the local tf
+	vocab_file.write(reinterpret_cast<char*>(&non_zero_count), sizeof(int32_t));
+	vocab_file.write(reinterpret_cast<char*> (local_words_.data()), sizeof(int32_t)* non_zero_count);
+	for (int32_t word_id : local_words_)
+	{
+		vocab_file.write(reinterpret_cast<const char*> (&global_tf_[word_id]), sizeof(int32_t));
+	}
+	for (int32_t word_id : local_words_)
+	{
+		vocab_file.write(reinterpret_cast<char*> (&local_tf_[word_id]), sizeof(int32_t));
+	}
+	vocab_file.close();
 
-			if (buf_idx_ + doc_buf_idx > buf_size_)
-			{
-				block_file.write(reinterpret_cast<char*> (block_buf_), sizeof(int32_t)* buf_idx_);
-				buf_idx_ = 0;
-			}
+	txt_vocab_file << non_zero_count << std::endl;
+	for (int32_t word_id : local_words_)
+	{
+		txt_vocab_file << word_id << "\t" << global_tf_[word_id] << "\t" << local_tf_[word_id] << std::endl;
+		local_tf_[word_id] = 0;
+	}
+	txt_vocab_file.close();
 
-			memcpy(block_buf_ + buf_idx_, block_buf, doc_buf_idx * sizeof(int32_t));
-			buf_idx_ += doc_buf_idx;
-			offset_buf_[j + 1] = offset_buf_[j] + doc_buf_idx;
-			total_token += doc_buf_idx / 2;
-		}
+	LOG(INFO) << "The number of tokens in block " << i << " is: " << block_token_num;
+	LOG(INFO) << "Local vocab_size for block " << i << " is: " << non_zero_count;
+
+	std::cout << "The number of tokens in block " << i << " is: " << block_token_num << std::endl;
+	std::cout << "Local vocab_size for block " << i << " is: " << non_zero_count << std::endl;
+}
+
+// Fills block i + 1 while block i is written. fill_block(doc_begin, block)
+// converts the docs [doc_begin, doc_begin + block.num_docs) to word ids.
+template <typename FillBlock>
+void dump_blocks(FillBlock fill_block, const std::vector<int32_t> &global_tf,
+	std::string output_dir, int32_t block_num, std::vector<int32_t> &blocks_size)
+{
+	BlockWriter writer(global_tf, 10000 * FLAGS_mean_doc_size, FLAGS_append ? kUnassignedTopic : 0);
+	BlockDocs blocks[2];
+	std::thread writer_thread;
+	int64_t doc_begin = 0;
+	for (int32_t i = 0; i < block_num; ++i)
+	{
+		BlockDocs& block = blocks[i % 2];
+		block.block_id = i;
+		block.num_docs = blocks_size[i];
+		fill_block(doc_begin, block);
+		doc_begin += block.num_docs;
+
+		if (writer_thread.joinable()) writer_thread.join();
+		BlockDocs* written = &block;
+		writer_thread = std::thread([&writer, written, &output_dir]() { writer.Write(*written, output_dir); });
+	}
+	if (writer_thread.joinable()) writer_thread.join();
+
+	LOG(INFO) << "Total tokens: " << writer.TotalToken();
+	std::cout << "Total tokens: " << writer.TotalToken() << std::endl;
+}
+
+// A read-only mapping of an input file
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string &filename) : data_(nullptr), size_(0)
+	{
+		fd_ = open(filename.c_str(), O_RDONLY);
+		CHECK_NE(fd_, -1) << "Fails to open file: " << filename << ": " << strerror(errno);
+		struct stat file_stat;
+		CHECK_EQ(fstat(fd_, &file_stat), 0) << "Fails to stat file: " << filename;
+		size_ = file_stat.st_size;
+		if (size_ == 0) return;
+		void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+		CHECK(data != MAP_FAILED) << "Fails to mmap file: " << filename << ": " << strerror(errno);
+		madvise(data, size_, MADV_SEQUENTIAL);
+		data_ = static_cast<const char*>(data);
+	}
+
+	~MappedFile()
+	{
+		if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+		close(fd_);
+	}
+
+	const char* Data() const { return data_; }
+	int64_t Size() const { return size_; }
 
-		// add local vocabs end offset.
-		// offset_buf_[block_size + 1] = offset_buf_[block_size] + local_vocabs.size();
+private:
+	int fd_;
+	const char* data_;
+	int64_t size_;
 
-		if (buf_idx_ != 0)
+	MappedFile(const MappedFile&);
+	void operator=(const MappedFile&);
+};
+
+// Moves p past the next non-empty line of [p, end) and returns it in
+// [line_begin, line_end), returns false at the end.
+inline bool next_line(const char* &p, const char* end, const char* &line_begin, const char* &line_end)
+{
+	while (p < end && *p == '\n') ++p;
+	if (p >= end) return false;
+	line_begin = p;
+	const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+	line_end = newline != nullptr ? newline : end;
+	p = newline != nullptr ? newline + 1 : end;
+	return true;
+}
+
+// Calls func(word_id, count) for the features "id[:count]" of a libsvm or
+// TSV line, which follow the label or doc id up to the first tab. A count
+// with a fraction is truncated.
+template <typename Func>
+void parse_features(const char* begin, const char* end, Func func)
+{
+	const char* p = static_cast<const char*>(memchr(begin, '\t', end - begin));
+	if (p == nullptr) return; // empty doc, only the label
+	++p;
+	while (p < end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+		if (p == end) break;
+		CHECK(*p >= '0' && *p <= '9') << "Invalid feature in line: " << std::string(begin, end);
+		int64_t word_id = 0;
+		while (p < end && *p >= '0' && *p <= '9') word_id = word_id * 10 + (*p++ - '0');
+		int64_t count = 1;
+		if (p < end && *p == ':')
 		{
-			block_file.write(reinterpret_cast<char*> (block_buf_), sizeof(int32_t)* buf_idx_);
-			buf_idx_ = 0;
+			count = 0;
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p) count = count * 10 + (*p - '0');
 		}
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+		CHECK_LT(word_id, std::numeric_limits<int32_t>::max()) << "Word id out of range in line: " << std::string(begin, end);
+		func(static_cast<int32_t>(word_id), count);
+	}
+}
+
+// Libsvm or TSV files with one doc per line and word ids as features. The
+// files are mapped and cut at line boundaries in pieces the threads parse
+// in parallel, the docs being numbered in file order.
+class LibsvmInput
+{
+public:
+	explicit LibsvmInput(const std::vector<std::string> &filenames);
+
+	// Counts the docs and the tf of each word id. With cluster_docs, also
+	// sketches the word ids of each doc and keeps the start of its line.
+	void Count(std::vector<int32_t> &global_tf);
 
+	int64_t NumDocs() const { return num_docs_; }
 
-		block_file.seekp(4);
+	// Orders the docs by the MinHash of their word ids occuring at least
+	// vocab_min_occurence times, given the tf of the input ids.
+	void OrderDocs(const std::vector<int32_t> &global_tf);
 
-		// write the length of each doc in this block
-		block_file.write(reinterpret_cast<char*> (offset_buf_), sizeof(int64_t)* (block_size + 1));
-		block_file.close();
+	// Fills block with the docs [doc_begin, doc_begin + block.num_docs) in
+	// input order, or MinHash order after OrderDocs, leaving out the word
+	// ids with a tf below vocab_min_occurence.
+	// id_map: the word id of each input id, or empty to keep the input ids
+	void FillBlock(int64_t doc_begin, const std::vector<int32_t> &global_tf,
+		const std::vector<int32_t> &id_map, BlockDocs &block);
+
+private:
+	// the offset of every kIndexStep-th doc of a piece is kept to start
+	// parsing a piece from the middle
+	static const int32_t kIndexStep = 1024;
+
+	struct Piece
+	{
+		const char* begin; // at the start of a line
+		const char* end;
+		int64_t first_doc;
+		int64_t num_docs;
+		std::vector<const char*> doc_index; // doc k * kIndexStep
+		std::vector<const char*> doc_lines; // every doc, with cluster_docs
+		DocSketches sketches;
+	};
+
+	// Parses the doc of [line_begin, line_end) into doc_words.
+	void ParseDoc(const char* line_begin, const char* line_end, const std::vector<int32_t> &global_tf,
+		const std::vector<int32_t> &id_map, std::vector<int32_t> &doc_words) const;
+
+	std::vector<std::unique_ptr<MappedFile>> files_;
+	std::vector<Piece> pieces_;
+	int64_t num_docs_;
+	std::vector<int64_t> doc_order_; // the input doc at each position
+};
 
-		int32_t vocab_size = 0;
-		
-		vocab_file.write(reinterpret_cast<char*>(&vocab_size), sizeof(int32_t));
-		int32_t non_zero_count = 0;
-		// write vocab
-		for (int i = 0; i < local_vocabs.size(); ++i) 
+LibsvmInput::LibsvmInput(const std::vector<std::string> &filenames) : num_docs_(0)
+{
+	const int64_t kMinPieceSize = 1 << 20;
+	for (const std::string& filename : filenames)
+	{
+		files_.emplace_back(new MappedFile(filename));
+		const MappedFile& file = *files_.back();
+		const char* data = file.Data();
+		int64_t size = file.Size();
+		int64_t num_pieces = std::max<int64_t>(1, std::min<int64_t>(size / kMinPieceSize, 4 * num_threads_));
+		int64_t begin = 0;
+		for (int64_t k = 1; k <= num_pieces && begin < size; ++k)
 		{
-			if (local_vocabs[i] > 0)
+			int64_t end = size * k / num_pieces;
+			if (end <= begin) continue;
+			if (end < size)
 			{
-				non_zero_count++;
-				vocab_file.write(reinterpret_cast<char*> (&i), sizeof(int32_t));
+				const char* newline = static_cast<const char*>(memchr(data + end - 1, '\n', size - end + 1));
+				end = newline != nullptr ? newline + 1 - data : size;
 			}
+			Piece piece;
+			piece.begin = data + begin;
+			piece.end = data + end;
+			piece.first_doc = 0;
+			piece.num_docs = 0;
+			pieces_.push_back(piece);
+			begin = end;
 		}
-		LOG(INFO) << "The number of tokens in block " << i << " is: " << block_token_num;
-		LOG(INFO) << "Local vocab_size for block " << i << " is: " << non_zero_count;
-
-		std::cout << "The number of tokens in block " << i << " is: " << block_token_num << std::endl;
-		std::cout << "Local vocab_size for block " << i << " is: " << non_zero_count << std::endl;
-		
-		//std::ofstream txt_vocab
+		LOG(INFO) << "Input file " << filename << ": " << size << " bytes";
+	}
+}
 
-		// write global tf
-		for (int i = 0; i < local_vocabs.size(); ++i)
+void LibsvmInput::Count(std::vector<int32_t> &global_tf)
+{
+	std::vector<std::vector<int32_t>> thread_tf(num_threads_);
+	std::atomic<int32_t> next_piece(0);
+	parallel_run([&](int32_t thread_id) {
+		std::vector<int32_t>& tf = thread_tf[thread_id];
+		for (int32_t i = next_piece++; i < static_cast<int32_t>(pieces_.size()); i = next_piece++)
 		{
-			if (local_vocabs[i] > 0)
+			Piece& piece = pieces_[i];
+			const char* p = piece.begin;
+			const char* line_begin;
+			const char* line_end;
+			while (next_line(p, piece.end, line_begin, line_end))
 			{
-				vocab_file.write(reinterpret_cast<char*> (&global_tf_map[i]), sizeof(int32_t));
+				if (piece.num_docs % kIndexStep == 0) piece.doc_index.push_back(line_begin);
+				++piece.num_docs;
+				int64_t doc = -1;
+				if (FLAGS_cluster_docs)
+				{
+					piece.doc_lines.push_back(line_begin);
+					doc = piece.sketches.AddDoc();
+				}
+				parse_features(line_begin, line_end, [&](int32_t word_id, int64_t count) {
+					if (word_id >= static_cast<int32_t>(tf.size()))
+						tf.resize(std::max<int64_t>(word_id + 1, 2 * tf.size()), 0);
+					tf[word_id] += static_cast<int32_t>(count);
+					if (doc >= 0) piece.sketches.Add(doc, sketch_hash(id_hash(word_id)));
+				});
 			}
 		}
-		// write local tf
-		for (int i = 0; i < local_vocabs.size(); ++i)
+	});
+
+	for (Piece& piece : pieces_)
+	{
+		piece.first_doc = num_docs_;
+		num_docs_ += piece.num_docs;
+	}
+
+	// each thread sums a range of word ids, the vocabulary ends at the
+	// largest word id seen
+	int64_t num_words = 0;
+	for (auto& tf : thread_tf)
+	{
+		for (int64_t word_id = tf.size() - 1; word_id >= num_words; --word_id)
 		{
-			if (local_vocabs[i] > 0)
+			if (tf[word_id] != 0)
 			{
-				vocab_file.write(reinterpret_cast<char*> (&local_vocabs[i]), sizeof(int32_t));
+				num_words = word_id + 1;
+				break;
 			}
 		}
-		vocab_file.seekp(0);
-		vocab_file.write(reinterpret_cast<char*>(&non_zero_count), sizeof(int32_t));
+	}
+	global_tf.assign(num_words, 0);
+	parallel_run([&](int32_t thread_id) {
+		int64_t begin = num_words * thread_id / num_threads_;
+		int64_t end = num_words * (thread_id + 1) / num_threads_;
+		for (auto& tf : thread_tf)
+		{
+			for (int64_t word_id = begin; word_id < std::min<int64_t>(end, tf.size()); ++word_id)
+				global_tf[word_id] += tf[word_id];
+		}
+	});
+}
 
-		vocab_file.close();
+void LibsvmInput::OrderDocs(const std::vector<int32_t> &global_tf)
+{
+	DocSketches sketches;
+	for (const Piece& piece : pieces_)
+		sketches.Append(piece.sketches);
+	std::vector<uint32_t> vocab_hashes;
+	for (int32_t word_id = 0; word_id < static_cast<int32_t>(global_tf.size()); ++word_id)
+	{
+		if (global_tf[word_id] > 0 && global_tf[word_id] >= FLAGS_vocab_min_occurence)
+			vocab_hashes.push_back(sketch_hash(id_hash(word_id)));
+	}
+	std::sort(vocab_hashes.begin(), vocab_hashes.end());
+	doc_order_ = sketches.Order(vocab_hashes);
+}
+
+void LibsvmInput::ParseDoc(const char* line_begin, const char* line_end, const std::vector<int32_t> &global_tf,
+	const std::vector<int32_t> &id_map, std::vector<int32_t> &doc_words) const
+{
+	doc_words.clear();
+	parse_features(line_begin, line_end, [&](int32_t word_id, int64_t count) {
+		if (word_id >= static_cast<int32_t>(global_tf.size())) return;
+		if (!id_map.empty()) word_id = id_map[word_id];
+		if (global_tf[word_id] < FLAGS_vocab_min_occurence) return;
+		for (int64_t k = 0; k < count && static_cast<int32_t>(doc_words.size()) < kMaxDocSize; ++k)
+			doc_words.push_back(word_id);
+	});
+	std::sort(doc_words.begin(), doc_words.end());
+}
 
-		txt_vocab_file << non_zero_count << std::endl;
-		for (int i = 0; i < local_vocabs.size(); ++i)
+void LibsvmInput::FillBlock(int64_t doc_begin, const std::vector<int32_t> &global_tf,
+	const std::vector<int32_t> &id_map, BlockDocs &block)
+{
+	if (static_cast<int32_t>(block.docs.size()) < block.num_docs) block.docs.resize(block.num_docs);
+
+	if (!doc_order_.empty())
+	{
+		// each doc is found from its line start, the piece bounding its line
+		std::atomic<int32_t> next_doc(0);
+		parallel_run([&](int32_t thread_id) {
+			for (int32_t begin = next_doc.fetch_add(kDocChunkSize); begin < block.num_docs;
+				begin = next_doc.fetch_add(kDocChunkSize))
+			{
+				int32_t end = std::min(begin + kDocChunkSize, block.num_docs);
+				for (int32_t j = begin; j < end; ++j)
+				{
+					int64_t doc = doc_order_[doc_begin + j];
+					auto piece = std::upper_bound(pieces_.begin(), pieces_.end(), doc,
+						[](int64_t doc, const Piece& piece) { return doc < piece.first_doc; }) - 1;
+					const char* p = piece->doc_lines[doc - piece->first_doc];
+					const char* line_begin;
+					const char* line_end;
+					CHECK(next_line(p, piece->end, line_begin, line_end));
+					ParseDoc(line_begin, line_end, global_tf, id_map, block.docs[j]);
+				}
+			}
+		});
+		return;
+	}
+
+	int64_t doc_end = doc_begin + block.num_docs;
+	// cut the docs of the block in runs of at most kIndexStep docs which
+	// start after an indexed doc
+	struct Run
+	{
+		const Piece* piece;
+		int64_t begin; // doc index in the piece
+		int64_t end;
+	};
+	std::vector<Run> runs;
+	for (const Piece& piece : pieces_)
+	{
+		int64_t begin = std::max(doc_begin, piece.first_doc) - piece.first_doc;
+		int64_t end = std::min(doc_end, piece.first_doc + piece.num_docs) - piece.first_doc;
+		while (begin < end)
+		{
+			int64_t run_end = std::min(end, (begin / kIndexStep + 1) * kIndexStep);
+			runs.push_back({ &piece, begin, run_end });
+			begin = run_end;
+		}
+	}
+
+	std::atomic<int32_t> next_run(0);
+	parallel_run([&](int32_t thread_id) {
+		for (int32_t i = next_run++; i < static_cast<int32_t>(runs.size()); i = next_run++)
 		{
-			if (local_vocabs[i] > 0)
+			const Run& run = runs[i];
+			const char* p = run.piece->doc_index[run.begin / kIndexStep];
+			const char* line_begin;
+			const char* line_end;
+			for (int64_t doc = run.begin / kIndexStep * kIndexStep; doc < run.end; ++doc)
 			{
-				// vocab_file.write(reinterpret_cast<char*> (&local_vocabs[i]), sizeof(int32_t));
-				txt_vocab_file << i << "\t" << global_tf_map[i] << "\t" << local_vocabs[i] << std::endl;
+				CHECK(next_line(p, run.piece->end, line_begin, line_end));
+				if (doc < run.begin) continue;
+				ParseDoc(line_begin, line_end, global_tf, id_map, block.docs[run.piece->first_doc + doc - doc_begin]);
 			}
 		}
-		txt_vocab_file.close();
+	});
+}
+
+// word_tf.txt for word ids given in the input: "id input_id tf" for every id
+// up to the largest one, so that its line count is the vocabulary size.
+// input_ids: the input id of each word id, or empty if they are the same.
+void dump_id_dict(const std::vector<int32_t> &global_tf, const std::vector<int32_t> &input_ids,
+	std::string datablocks_dir) {
+	std::string word_dict_filename = datablocks_dir + "/word_tf.txt";
+	std::ofstream word_dict_file(word_dict_filename, std::ios::out);
+	CHECK(word_dict_file.good()) << "Fails to create file: " << word_dict_filename;
+	for (int32_t id = 0; id < static_cast<int32_t>(global_tf.size()); ++id) {
+		int32_t tf = global_tf[id] >= FLAGS_vocab_min_occurence ? global_tf[id] : 0;
+		word_dict_file << id << " " << (input_ids.empty() ? id : input_ids[id]) << " " << tf << "\n";
+	}
+	word_dict_file.close();
+}
+
+// Numbers the input word ids. The input ids of input_ids keep their ids,
+// the other input ids follow in input order, or by descending global tf
+// with word_id_by_frequency, ties by input id and the ids below
+// vocab_min_occurence last. global_tf is permuted to the new ids,
+// input_ids gets the input id of each new id and id_map the inverse. Both
+// are left empty if the ids are the input ids.
+void number_input_ids(std::vector<int32_t> &global_tf, std::vector<int32_t> &input_ids,
+	std::vector<int32_t> &id_map) {
+	int32_t num_words = static_cast<int32_t>(global_tf.size());
+	auto kept_tf = [&](int32_t id) {
+		return global_tf[id] >= FLAGS_vocab_min_occurence ? global_tf[id] : 0;
+	};
+	id_map.assign(num_words, -1);
+	for (int32_t id = 0; id < static_cast<int32_t>(input_ids.size()); ++id)
+		id_map[input_ids[id]] = id;
+	std::vector<int32_t> new_ids;
+	for (int32_t input_id = 0; input_id < num_words; ++input_id)
+		if (id_map[input_id] < 0) new_ids.push_back(input_id);
+	if (FLAGS_word_id_by_frequency) {
+		std::stable_sort(new_ids.begin(), new_ids.end(), [&](int32_t id1, int32_t id2) {
+			return kept_tf(id1) > kept_tf(id2);
+		});
+	}
+	bool same_ids = true;
+	for (int32_t input_id : new_ids)
+	{
+		id_map[input_id] = static_cast<int32_t>(input_ids.size());
+		input_ids.push_back(input_id);
+	}
+	for (int32_t id = 0; id < num_words; ++id)
+		same_ids = same_ids && input_ids[id] == id;
+	if (same_ids) {
+		input_ids.clear();
+		id_map.clear();
+		return;
 	}
-	LOG(INFO) << "Total tokens: " << total_token;
-	std::cout << "Total tokens: " << total_token << std::endl;
 
-	delete[] block_buf;
+	std::vector<int32_t> input_tf;
+	input_tf.swap(global_tf);
+	global_tf.resize(num_words);
+	for (int32_t id = 0; id < num_words; ++id)
+		global_tf[id] = input_tf[input_ids[id]];
+}
+
+// Reads the word_tf.txt of the word ids given in the input, "id input_id
+// tf", into the input id and the tf of each id.
+void load_id_dict(std::string datablocks_dir, std::vector<int32_t> &input_ids, std::vector<int32_t> &tf) {
+	std::string word_dict_filename = datablocks_dir + "/word_tf.txt";
+	std::ifstream word_dict_file(word_dict_filename, std::ios::in);
+	CHECK(word_dict_file.good()) << "Fails to open file: " << word_dict_filename;
+	int32_t id, input_id, word_tf;
+	while (word_dict_file >> id >> input_id >> word_tf) {
+		CHECK_EQ(id, static_cast<int32_t>(input_ids.size())) << "Unordered word id in " << word_dict_filename;
+		input_ids.push_back(input_id);
+		tf.push_back(word_tf);
+	}
+	// a word in place of the input id stops the loop before the end
+	CHECK(word_dict_file.eof()) << word_dict_filename << " was generated with input_format=dir"
+		<< " or is invalid at word id " << input_ids.size() << ", it can not be appended with input_format=libsvm";
+	CHECK(!input_ids.empty()) << "No word in " << word_dict_filename;
+	word_dict_file.close();
 }
 
 void get_filenames(std::string input_dir, std::vector<std::string> &filenames) {
@@ -300,68 +1017,298 @@ void get_filenames(std::string input_dir, std::vector<std::string> &filenames) {
     for( boost::filesystem::directory_iterator itr(input_dir); itr != end_itr; ++itr)
     {
         if(!boost::filesystem::is_regular_file(itr->status())) continue;
-        std::string filename = itr->path().string(); 
+        std::string filename = itr->path().string();
         filenames.push_back(filename);
     }
     std::random_shuffle(filenames.begin(), filenames.end());
 }
 
-void count_tf_df(std::vector<std::string> &filenames, 
-        std::map<std::string, std::pair<int32_t, int32_t> > &global_tf_df) {
-    for (std::string filename: filenames) {
-	    std::ifstream input_file(filename, std::ios::in);
-	    CHECK(input_file.good()) << "Fails to open file: " << filename;
-        std::string str_line;
-        std::map<std::string, int32_t> document_df;
-        while (getline(input_file, str_line)) {
-		    if (!str_line.empty()) {
-                boost::tokenizer<> tok(str_line);
-                for (boost::tokenizer<>::iterator itr=tok.begin(); itr!=tok.end(); ++itr) {
-                    std::string token = *itr;
-                    std::transform(token.begin(), token.end(), token.begin(), ::tolower);
-                    if (global_tf_df.find(token) == global_tf_df.end()) {
-                        global_tf_df[token] = std::make_pair<int32_t, int32_t>(0,0);
-                    }
-                    int tf = global_tf_df[token].first;
-                    int df = global_tf_df[token].second;
-                    ++tf;
-                    if (document_df.find(token) == document_df.end()) {
-                        ++df;
-                        document_df[token] = 1;
-                    }
-                    global_tf_df[token].first = tf;
-                    global_tf_df[token].second = df;
-                }
-            }
-        }
-        input_file.close();
-    }
+// A sorted run of word counts spilled to disk: per word, the length
+// (uint32), the characters, tf and df (int32).
+class CountRunReader {
+public:
+	explicit CountRunReader(const std::string &filename) :
+		file_(filename, std::ios::in | std::ios::binary), tf_(0), df_(0)
+	{
+		CHECK(file_.good()) << "Fails to open file: " << filename;
+	}
+
+	// Reads the next word, returns false at the end of the run.
+	bool Next()
+	{
+		uint32_t length;
+		if (!file_.read(reinterpret_cast<char*>(&length), sizeof(uint32_t))) return false;
+		word_.resize(length);
+		file_.read(&word_[0], length);
+		file_.read(reinterpret_cast<char*>(&tf_), sizeof(int32_t));
+		file_.read(reinterpret_cast<char*>(&df_), sizeof(int32_t));
+		CHECK(file_.good()) << "Truncated word count run";
+		return true;
+	}
+
+	const std::string& Word() const { return word_; }
+	int32_t Tf() const { return tf_; }
+	int32_t Df() const { return df_; }
+
+private:
+	std::ifstream file_;
+	std::string word_;
+	int32_t tf_;
+	int32_t df_;
+};
+
+// Writes the counts sorted by word to run_name and clears them.
+void spill_counts(FlatDict<TermCount> &counts, const std::string &run_name)
+{
+	struct Entry {
+		const char* word;
+		int32_t length;
+		const TermCount* count;
+	};
+	std::vector<Entry> entries;
+	entries.reserve(counts.Size());
+	counts.ForEach([&](const char* word, int32_t length, uint64_t hash, const TermCount& count) {
+		entries.push_back({ word, length, &count });
+	});
+	std::sort(entries.begin(), entries.end(), [](const Entry& entry1, const Entry& entry2) {
+		int result = memcmp(entry1.word, entry2.word, std::min(entry1.length, entry2.length));
+		return result != 0 ? result < 0 : entry1.length < entry2.length;
+	});
+
+	std::ofstream run_file(run_name, std::ios::out | std::ios::binary);
+	CHECK(run_file.good()) << "Fails to create file: " << run_name;
+	for (const Entry& entry : entries) {
+		uint32_t length = entry.length;
+		run_file.write(reinterpret_cast<char*>(&length), sizeof(uint32_t));
+		run_file.write(entry.word, length);
+		run_file.write(reinterpret_cast<const char*>(&entry.count->tf), sizeof(int32_t));
+		run_file.write(reinterpret_cast<const char*>(&entry.count->df), sizeof(int32_t));
+	}
+	CHECK(run_file.good()) << "Fails to write file: " << run_name;
+	run_file.close();
+	counts = FlatDict<TermCount>();
+}
+
+// Merges the sorted runs into the dictionary, adding to the words already
+// there and keeping the other words only if they occur at least
+// vocab_min_occurence times. The runs are deleted.
+void merge_count_runs(const std::vector<std::string> &run_names, Dictionary &dictionary)
+{
+	std::vector<std::unique_ptr<CountRunReader>> runs;
+	for (const std::string& run_name : run_names)
+		runs.emplace_back(new CountRunReader(run_name));
+	auto greater = [](const CountRunReader* run1, const CountRunReader* run2) {
+		return run1->Word() > run2->Word();
+	};
+	std::priority_queue<CountRunReader*, std::vector<CountRunReader*>, decltype(greater)> heap(greater);
+	for (auto& run : runs)
+		if (run->Next()) heap.push(run.get());
+
+	if (dictionary.empty()) dictionary.assign(num_threads_, FlatDict<TermCount>());
+	int64_t num_words = 0;
+	int64_t num_kept = 0;
+	std::string word;
+	while (!heap.empty()) {
+		word = heap.top()->Word();
+		int32_t tf = 0, df = 0;
+		while (!heap.empty() && heap.top()->Word() == word) {
+			CountRunReader* run = heap.top();
+			heap.pop();
+			tf += run->Tf();
+			df += run->Df();
+			if (run->Next()) heap.push(run);
+		}
+		++num_words;
+		int32_t length = static_cast<int32_t>(word.size());
+		uint64_t hash = FlatDict<TermCount>::Hash(word.data(), length);
+		FlatDict<TermCount>& partition = dictionary[partition_of(hash)];
+		TermCount* count = partition.Find(word.data(), length, hash);
+		if (count == nullptr)
+		{
+			if (tf <= 0 || tf < FLAGS_vocab_min_occurence) continue;
+			count = &partition.Insert(word.data(), length, hash);
+		}
+		++num_kept;
+		count->tf += tf;
+		count->df += df;
+	}
+	runs.clear();
+	for (const std::string& run_name : run_names)
+		std::remove(run_name.c_str());
+	LOG(INFO) << "Merged " << run_names.size() << " word count runs: " << num_words
+		<< " words, " << num_kept << " occuring often enough";
+}
+
+// Counts the tf and df of the words, each thread over chunks of the files
+// into its own dictionary, then each thread merges its partition of words
+// into dictionary, adding to the words already there.
+// With vocab_memory_budget, a thread whose dictionary outgrows its share
+// of the budget spills it to a sorted run after the current doc, and the
+// runs are merged into a dictionary of the vocabulary words only.
+// sketches: sketches the words of each doc if not null.
+void count_tf_df(std::vector<std::string> &filenames, Dictionary &dictionary, DocSketches *sketches) {
+	Dictionary thread_counts(num_threads_);
+	int64_t thread_budget = FLAGS_vocab_memory_budget * 1024 * 1024 / num_threads_;
+	std::vector<std::vector<std::string>> thread_runs(num_threads_);
+	std::atomic<int32_t> next_doc(0);
+	int32_t doc_num = static_cast<int32_t>(filenames.size());
+	if (sketches != nullptr) sketches->Resize(doc_num);
+	parallel_run([&](int32_t thread_id) {
+		FlatDict<TermCount>& counts = thread_counts[thread_id];
+		std::vector<std::string>& runs = thread_runs[thread_id];
+		auto spill = [&]() {
+			runs.push_back(FLAGS_datablocks_dir + "/word_count_run." + std::to_string(thread_id)
+				+ "." + std::to_string(runs.size()));
+			spill_counts(counts, runs.back());
+		};
+		std::string text, token;
+		for (int32_t begin = next_doc.fetch_add(kDocChunkSize); begin < doc_num;
+			begin = next_doc.fetch_add(kDocChunkSize))
+		{
+			int32_t end = std::min(begin + kDocChunkSize, doc_num);
+			for (int32_t doc = begin; doc < end; ++doc)
+			{
+				read_file(filenames[doc], text);
+				tokenize(text, token, [&](const char* word, int32_t length) {
+					uint64_t hash = FlatDict<TermCount>::Hash(word, length);
+					TermCount& count = counts.Insert(word, length, hash);
+					++count.tf;
+					if (count.last_doc != doc)
+					{
+						++count.df;
+						count.last_doc = doc;
+						if (sketches != nullptr) sketches->Add(doc, sketch_hash(hash));
+					}
+					return true;
+				});
+				if (thread_budget > 0 && counts.MemorySize() > thread_budget) spill();
+			}
+		}
+		if (thread_budget > 0 && counts.Size() > 0) spill();
+	});
+
+	if (thread_budget > 0) {
+		std::vector<std::string> run_names;
+		for (auto& runs : thread_runs)
+			run_names.insert(run_names.end(), runs.begin(), runs.end());
+		merge_count_runs(run_names, dictionary);
+		return;
+	}
+
+	if (dictionary.empty()) dictionary.assign(num_threads_, FlatDict<TermCount>());
+	parallel_run([&](int32_t thread_id) {
+		FlatDict<TermCount>& partition = dictionary[thread_id];
+		for (auto& counts : thread_counts)
+		{
+			counts.ForEach([&](const char* word, int32_t length, uint64_t hash, const TermCount& count) {
+				if (partition_of(hash) != thread_id) return;
+				TermCount& total = partition.Insert(word, length, hash);
+				total.tf += count.tf;
+				total.df += count.df;
+			});
+		}
+	});
 }
 
-void remove_stopwords(std::string stopword_filename,
-        std::map<std::string, std::pair<int32_t, int32_t> > &global_tf_df) {
+void remove_stopwords(std::string stopword_filename, Dictionary &dictionary) {
 	std::ifstream stopword_file(stopword_filename, std::ios::in);
 	CHECK(stopword_file.good()) << "Fails to open file: " << stopword_filename;
     std::string stopword;
     while (stopword_file >> stopword) {
-        std::map<std::string, std::pair<int32_t, int32_t> >::iterator it = global_tf_df.find(stopword);
-        if (it != global_tf_df.end()) {
-            global_tf_df.erase(it);
-        }
+		uint64_t hash = FlatDict<TermCount>::Hash(stopword.data(), static_cast<int32_t>(stopword.size()));
+		TermCount* count = dictionary[partition_of(hash)].Find(stopword.data(),
+			static_cast<int32_t>(stopword.size()), hash);
+		// a word with no occurence is left out of the vocabulary, the words
+		// of an appended vocabulary keep their ids
+		if (count != nullptr && count->id < 0) count->tf = 0;
     }
     stopword_file.close();
 }
 
-void dump_word_dict(std::vector<std::tuple<std::string, int32_t, int32_t> > &tf_df_vec, std::string datablocks_dir) {
+struct VocabWord {
+	const char* word;
+	int32_t length;
+	TermCount* count;
+};
+
+void dump_word_dict(std::vector<VocabWord> &vocab, std::string datablocks_dir) {
     std::string word_dict_filename = datablocks_dir + "/word_tf.txt";
     std::ofstream word_dict_file(word_dict_filename, std::ios::out);
     CHECK(word_dict_file.good()) << "Fails to create file: " << word_dict_filename;
     int id = 0;
-    for (std::tuple<std::string, int32_t, int32_t> tf_df : tf_df_vec) {
-        word_dict_file << id++ << " " << std::get<0>(tf_df) << " " << std::get<1>(tf_df) << std::endl;
+    for (VocabWord& word : vocab) {
+        word_dict_file << id++ << " ";
+        word_dict_file.write(word.word, word.length);
+        word_dict_file << " " << word.count->tf << std::endl;
     }
     word_dict_file.close();
 }
+
+// Adds the words of the word_tf.txt of datablocks_dir to the dictionary
+// with their id and tf, returns their number.
+int32_t load_word_dict(std::string datablocks_dir, Dictionary &dictionary) {
+	std::string word_dict_filename = datablocks_dir + "/word_tf.txt";
+	std::ifstream word_dict_file(word_dict_filename, std::ios::in);
+	CHECK(word_dict_file.good()) << "Fails to open file: " << word_dict_filename;
+	if (dictionary.empty()) dictionary.assign(num_threads_, FlatDict<TermCount>());
+	int32_t num_words = 0;
+	int32_t id, tf;
+	std::string word;
+	bool numeric_words = true;
+	while (word_dict_file >> id >> word >> tf) {
+		CHECK_EQ(id, num_words) << "Unordered word id in " << word_dict_filename;
+		numeric_words = numeric_words && std::all_of(word.begin(), word.end(),
+			[](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; });
+		int32_t length = static_cast<int32_t>(word.size());
+		uint64_t hash = FlatDict<TermCount>::Hash(word.data(), length);
+		TermCount& count = dictionary[partition_of(hash)].Insert(word.data(), length, hash);
+		CHECK_LT(count.id, 0) << "Duplicate word " << word << " in " << word_dict_filename;
+		count.tf = tf;
+		count.id = id;
+		++num_words;
+	}
+	CHECK(word_dict_file.eof()) << "Invalid " << word_dict_filename << " at word id " << num_words;
+	CHECK_GT(num_words, 0) << "No word in " << word_dict_filename;
+	// input_format=libsvm writes "id input_id tf"
+	CHECK(!numeric_words) << word_dict_filename << " was generated with input_format=libsvm"
+		<< ", it can not be appended with input_format=dir";
+	word_dict_file.close();
+	return num_words;
+}
+
+// Rewrites the global tf in the vocab files of the blocks [0, num_blocks)
+// of datablocks_dir, once documents are appended.
+void update_vocab_tf(const std::vector<int32_t> &global_tf, std::string datablocks_dir, int32_t num_blocks) {
+	std::vector<int32_t> word_ids, tf, local_tf;
+	for (int32_t i = 0; i < num_blocks; ++i) {
+		std::string vocab_name = datablocks_dir + "/vocab." + std::to_string(i);
+		std::string txt_vocab_name = vocab_name + ".txt";
+		std::fstream vocab_file(vocab_name, std::ios::in | std::ios::out | std::ios::binary);
+		CHECK(vocab_file.good()) << "Fails to open file: " << vocab_name;
+		int32_t num_words;
+		vocab_file.read(reinterpret_cast<char*>(&num_words), sizeof(int32_t));
+		word_ids.resize(num_words);
+		tf.resize(num_words);
+		local_tf.resize(num_words);
+		vocab_file.read(reinterpret_cast<char*>(word_ids.data()), sizeof(int32_t)* num_words);
+		vocab_file.read(reinterpret_cast<char*>(tf.data()), sizeof(int32_t)* num_words);
+		vocab_file.read(reinterpret_cast<char*>(local_tf.data()), sizeof(int32_t)* num_words);
+		CHECK(vocab_file.good()) << "Fails to read file: " << vocab_name;
+		for (int32_t k = 0; k < num_words; ++k)
+			tf[k] = global_tf[word_ids[k]];
+		vocab_file.seekp(sizeof(int32_t)* (1 + static_cast<int64_t>(num_words)));
+		vocab_file.write(reinterpret_cast<char*>(tf.data()), sizeof(int32_t)* num_words);
+		CHECK(vocab_file.good()) << "Fails to write file: " << vocab_name;
+		vocab_file.close();
+
+		std::ofstream txt_vocab_file(txt_vocab_name, std::ios::out);
+		CHECK(txt_vocab_file.good()) << "Fails to create file: " << txt_vocab_name;
+		txt_vocab_file << num_words << std::endl;
+		for (int32_t k = 0; k < num_words; ++k)
+			txt_vocab_file << word_ids[k] << "\t" << tf[k] << "\t" << local_tf[k] << std::endl;
+		txt_vocab_file.close();
+	}
+}
 int main(int argc, char* argv[]) {
 	google::ParseCommandLineFlags(&argc, &argv, true);
 	google::InitGoogleLogging(argv[0]);
@@ -370,63 +1317,123 @@ int main(int argc, char* argv[]) {
 
     std::srand(unsigned(std::time(0)));
 
-    std::vector<std::string> filenames;
-
-    get_filenames(FLAGS_input_dir, filenames);
+	num_threads_ = FLAGS_num_threads > 0 ? FLAGS_num_threads : std::max(1u, std::thread::hardware_concurrency());
+	LOG(INFO) << "Number of threads: " << num_threads_;
 
-    std::map<std::string, std::pair<int32_t, int32_t> > global_tf_df;
-    count_tf_df(filenames, global_tf_df);
-    remove_stopwords(FLAGS_vocab_stopword, global_tf_df);
-    std::vector<std::tuple<std::string, int32_t, int32_t> > tf_df_vec;
-    for (std::map<std::string, std::pair<int32_t, int32_t> >::iterator it = global_tf_df.begin();
-            it != global_tf_df.end(); ++it) {
-        tf_df_vec.push_back(std::make_tuple(it->first, it->second.first, it->second.second));
-    }
-    std::sort(tf_df_vec.begin(), tf_df_vec.end(), [](std::tuple<std::string, int32_t, int32_t> item1,
-                std::tuple<std::string, int32_t, int32_t> item2){return std::get<1>(item1) > std::get<1>(item2);});
-    std::vector<std::tuple<std::string, int32_t, int32_t> >::iterator itr = 
-        std::lower_bound(tf_df_vec.begin(), tf_df_vec.end(), 
-                std::make_tuple("", FLAGS_vocab_min_occurence-1, 0), [](std::tuple<std::string, int32_t, int32_t> item1, 
-                    std::tuple<std::string, int32_t, int32_t> item2){return std::get<1>(item1) > std::get<1>(item2);});
-    tf_df_vec.erase(itr, tf_df_vec.end());
-    std::random_shuffle(tf_df_vec.begin(), tf_df_vec.end());
-    dump_word_dict(tf_df_vec, FLAGS_datablocks_dir);
-    std::map<std::string, int32_t> word_to_id;
-    int id = 0;
-    for (auto tf_df : tf_df_vec) {
-        global_tf_map[id] = std::get<1>(tf_df);
-        word_to_id[std::get<0>(tf_df)] = id++;
-    }
-	buf_size_ = 10000 * FLAGS_mean_doc_size;
+    std::vector<std::string> filenames;
+	Dictionary dictionary;
+	std::unique_ptr<LibsvmInput> libsvm_input;
+	std::vector<int32_t> global_tf;
+	std::vector<int32_t> input_ids, id_map;
+	int64_t doc_num;
+
+	double count_start = get_time();
+	if (FLAGS_input_format == "libsvm") {
+		// the word ids are given, the vocabulary is built from their counts
+		if (FLAGS_input_file.empty()) {
+			get_filenames(FLAGS_input_dir, filenames);
+			std::sort(filenames.begin(), filenames.end());
+		}
+		else {
+			boost::split(filenames, FLAGS_input_file, boost::is_any_of(","));
+		}
+		libsvm_input.reset(new LibsvmInput(filenames));
+		libsvm_input->Count(global_tf);
+		doc_num = libsvm_input->NumDocs();
+		if (FLAGS_append) {
+			// add the tf of the existing blocks, the input ids keep their ids
+			std::vector<int32_t> old_tf;
+			load_id_dict(FLAGS_datablocks_dir, input_ids, old_tf);
+			int32_t num_words = static_cast<int32_t>(global_tf.size());
+			for (int32_t input_id : input_ids)
+				num_words = std::max(num_words, input_id + 1);
+			global_tf.resize(num_words, 0);
+			for (int32_t id = 0; id < static_cast<int32_t>(input_ids.size()); ++id)
+				global_tf[input_ids[id]] += old_tf[id];
+		}
+		if (FLAGS_cluster_docs)
+			libsvm_input->OrderDocs(global_tf);
+		if (!FLAGS_vocab_stopword.empty())
+			LOG(INFO) << "Stopwords are not applied to word ids";
+		number_input_ids(global_tf, input_ids, id_map);
+		dump_id_dict(global_tf, input_ids, FLAGS_datablocks_dir);
+	}
+	else {
+		CHECK_EQ(FLAGS_input_format, "dir") << "Unknown input_format";
+		get_filenames(FLAGS_input_dir, filenames);
+		int32_t num_old_words = 0;
+		if (FLAGS_append)
+			num_old_words = load_word_dict(FLAGS_datablocks_dir, dictionary);
+		DocSketches sketches;
+		count_tf_df(filenames, dictionary, FLAGS_cluster_docs ? &sketches : nullptr);
+		remove_stopwords(FLAGS_vocab_stopword, dictionary);
+		// the words of an appended vocabulary keep their ids, then come the
+		// words occuring at least vocab_min_occurence times, in random order
+		// or by descending tf
+		std::vector<VocabWord> vocab(num_old_words);
+		std::vector<VocabWord> new_words;
+		for (auto& partition : dictionary) {
+			partition.ForEach([&](const char* word, int32_t length, uint64_t hash, TermCount& count) {
+				if (count.id >= 0)
+					vocab[count.id] = { word, length, &count };
+				else if (count.tf > 0 && count.tf >= FLAGS_vocab_min_occurence)
+					new_words.push_back({ word, length, &count });
+			});
+		}
+		if (FLAGS_word_id_by_frequency) {
+			std::sort(new_words.begin(), new_words.end(), [](const VocabWord& word1, const VocabWord& word2) {
+				if (word1.count->tf != word2.count->tf) return word1.count->tf > word2.count->tf;
+				return std::string(word1.word, word1.length) < std::string(word2.word, word2.length);
+			});
+		}
+		else {
+			std::random_shuffle(new_words.begin(), new_words.end());
+		}
+		vocab.insert(vocab.end(), new_words.begin(), new_words.end());
+		dump_word_dict(vocab, FLAGS_datablocks_dir);
+		global_tf.resize(vocab.size());
+		for (int32_t id = 0; id < static_cast<int32_t>(vocab.size()); ++id) {
+			vocab[id].count->id = id;
+			global_tf[id] = vocab[id].count->tf;
+		}
+		doc_num = filenames.size();
+		if (FLAGS_cluster_docs) {
+			std::vector<uint32_t> vocab_hashes;
+			for (const VocabWord& word : vocab)
+				vocab_hashes.push_back(sketch_hash(FlatDict<TermCount>::Hash(word.word, word.length)));
+			std::sort(vocab_hashes.begin(), vocab_hashes.end());
+			std::vector<int64_t> order = sketches.Order(vocab_hashes);
+			std::vector<std::string> ordered_filenames(filenames.size());
+			for (int64_t doc = 0; doc < doc_num; ++doc)
+				ordered_filenames[doc].swap(filenames[order[doc]]);
+			filenames.swap(ordered_filenames);
+		}
+	}
+	double count_end = get_time();
+	LOG(INFO) << "Vocabulary size: " << global_tf.size();
+	LOG(INFO) << "Elapsed seconds for counting words: " << (count_end - count_start);
 
 	std::cout << "FLAGS_block_size = " << FLAGS_block_size << std::endl;
 	std::cout << "FLAGS_mean_doc_size = " << FLAGS_mean_doc_size << std::endl;
-	std::cout << "buf_size_ = " << buf_size_ << std::endl;
+	std::cout << "buf_size_ = " << 10000 * FLAGS_mean_doc_size << std::endl;
 
-	int64_t doc_num = filenames.size();
 	int32_t block_num;
 	std::vector<int32_t> blocks_size;
 
-	double alloc_start = get_time();
-	// offset
-	offset_buf_ = new int64_t[FLAGS_block_size + 2];
-	CHECK(offset_buf_) << "Memory allocation fails: offset_buf";
-
-	//std::cout << "offset_buf_ malloc ok" << std::endl;
-
-	block_buf_ = new int32_t[buf_size_];
-	CHECK(block_buf_) << "Memory allocation fails: word_buf";
-
-	std::cout << "block_buf_ malloc ok" << std::endl;
-
-	double alloc_end = get_time();
-	LOG(INFO) << "Elapsed seconds for allocation: " << (alloc_end - alloc_start);
+	// the new blocks follow the existing ones
+	int32_t num_old_blocks = 0;
+	if (FLAGS_append) {
+		while (boost::filesystem::exists(FLAGS_datablocks_dir + "/block." + std::to_string(num_old_blocks)))
+			++num_old_blocks;
+		FLAGS_file_offset = num_old_blocks;
+		LOG(INFO) << "Appending to " << num_old_blocks << " blocks";
+	}
 
 	LOG(INFO) << "Total number of docs: " << doc_num;
 
 	std::cout << "Calculating how many blocks to split..." << std::endl;
 
-	// Calculate the number of blocks, the size of each block based on 
+	// Calculate the number of blocks, the size of each block based on
 	// the total number of documents and the maximum size of each block
 	calc_block_num(doc_num, FLAGS_block_size, block_num, blocks_size);
 
@@ -436,19 +1443,27 @@ int main(int argc, char* argv[]) {
 	std::cout << "Total number of blocks: " << block_num << std::endl;
 	std::cout << "The size of general blocks: " << blocks_size.front() << std::endl;
 	std::cout << "The size of the last block: " << blocks_size.back() << std::endl;
-	
+
 
 	std::cout << "Dump binary blocks..." << std::endl;
 
 	// Dump the binary docs into seperate blocks
 	double dump_start = get_time();
-	dump_blocks(filenames, word_to_id, FLAGS_datablocks_dir, block_num, blocks_size);
+	if (libsvm_input) {
+		dump_blocks([&](int64_t doc_begin, BlockDocs &block) {
+			libsvm_input->FillBlock(doc_begin, global_tf, id_map, block);
+		}, global_tf, FLAGS_datablocks_dir, block_num, blocks_size);
+	}
+	else {
+		dump_blocks([&](int64_t doc_begin, BlockDocs &block) {
+			tokenize_block(filenames, dictionary, doc_begin, block);
+		}, global_tf, FLAGS_datablocks_dir, block_num, blocks_size);
+	}
+	if (FLAGS_append)
+		update_vocab_tf(global_tf, FLAGS_datablocks_dir, num_old_blocks);
 	double dump_end = get_time();
 	LOG(INFO) << "Elapsed seconds for dump blocks: " << (dump_end - dump_start);
 
-	delete[]offset_buf_;
-	delete[]block_buf_;
-
 	std::cout << "Success!" << std::endl;
 	return 0;
 }
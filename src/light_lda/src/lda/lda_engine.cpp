@@ -5,7 +5,9 @@
 
 #include "lda/lda_engine.hpp"
 #include <time.h>
+#include <unistd.h>
 #include <cstdlib>
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <memory>
@@ -38,6 +40,73 @@ namespace lda {
 		vocab_file_ = context.get_string("vocab_file");
 		num_blocks_ = context.get_int32("num_blocks");
 		cold_start_ = context.get_bool("cold_start");
+		delta_aggregation_ = context.get_bool("delta_aggregation");
+		delta_array_capacity_ = context.get_int32("delta_array_capacity");
+		balanced_shard_ = context.get_bool("delta_balanced_shard");
+		double_buffer_ = context.get_bool("delta_double_buffer");
+		// off with delta_double_buffer, see main
+		parallel_send_ = context.get_bool("delta_parallel_send");
+		delta_shard_.InitModulo(num_delta_threads_);
+		doc_scheduler_.Init(num_threads_, context.get_bool("doc_work_stealing"));
+		barrier_idle_time_.resize(num_threads_, 0.0);
+
+		int64_t data_cache_budget = context.get_int64("data_cache_budget") * 1024 * 1024;
+		if (data_cache_budget > 0 && num_blocks_ > 1)
+			block_cache_.reset(new BlockCache(num_blocks_, data_cache_budget));
+		block_offset_ = context.get_int32("block_offset");
+		int32_t num_data_io_threads = context.get_int32("data_io_threads");
+		if (num_data_io_threads > 0)
+		{
+			const int64_t kDataIOChunkSize = 8 << 20;
+			data_io_.reset(new util::AsyncIO(num_data_io_threads, kDataIOChunkSize));
+			// mapped blocks are not read
+			if (!context.get_bool("data_block_mmap") || context.get_bool("data_block_compress"))
+			{
+				// a block is written back two reads after it was read and read
+				// again num_blocks_ reads after, do not prefetch it before
+				int32_t prefetch_depth = (std::min)(context.get_int32("data_prefetch_depth"), num_blocks_ - 2);
+				prefetch_depth = (std::max)(prefetch_depth, 0);
+				block_prefetcher_.reset(new BlockPrefetcher(prefetch_depth + 1, *data_io_,
+					context.get_bool("data_direct_io")));
+			}
+		}
+
+		vocabs_.resize(num_blocks_);
+		ReadVocabs();
+
+		delta_io_threads_.resize(num_delta_threads_); // v-feigao: multi-delta threads
+		word_topic_delta_queues_.resize(num_delta_threads_);
+		// Each doc pushes at most 2 * kMaxSizeLightHash entries into one array
+		CHECK_GT(delta_array_capacity_, 2 * LDADocument::kMaxSizeLightHash) << "delta_array_capacity is too small";
+		// Aggregating workers only take an array when flushing, so one per (thread, shard) is enough
+		int32_t delta_pool_size = delta_aggregation_ ? 
+			num_threads_ * num_delta_threads_ : 2 * num_threads_ * num_delta_threads_; // sizeof(DeltaArray) = 48MB, 256 * 48MB = 12GB
+		int64_t delta_array_size = sizeof(petuum::DeltaArray::Delta) * static_cast<int64_t>(delta_array_capacity_);
+		int64_t delta_pool_budget = context.get_int64("delta_pool_budget") * 1024 * 1024;
+		const int64_t kMaxPoolSize = 1 << 20;
+		int32_t delta_pool_max_size = static_cast<int32_t>((std::min)(kMaxPoolSize,
+			(std::max)(static_cast<int64_t>(delta_pool_size), delta_pool_budget / delta_array_size)));
+		if (delta_pool_budget != 0 && delta_pool_budget < delta_pool_size * delta_array_size)
+		{
+			LOG(WARNING) << "delta_pool_budget = " << delta_pool_budget 
+				<< " is below the minimal delta pool size " << delta_pool_size * delta_array_size;
+		}
+		PlanMemory(delta_pool_size * delta_array_size);
+
+		int32_t delta_array_capacity = delta_array_capacity_;
+		delta_pool_.Init(delta_pool_size, delta_pool_max_size, 
+			[delta_array_capacity]() { return new petuum::DeltaArray(delta_array_capacity); });
+		LOG(INFO) << "Delta pool: array capacity = " << delta_array_capacity_ 
+			<< ". min arrays = " << delta_pool_size << ". max arrays = " << delta_pool_max_size;
+		// a queue never holds more arrays than the pool owns, so Push does not block
+		for (auto& queue : word_topic_delta_queues_)
+			queue.reset(new WordTopicDeltaQueue(delta_pool_max_size));
+		// each worker keeps its summary delta for the whole slice
+		worker_summary_deltas_.resize(num_threads_);
+		for (auto& summary_delta : worker_summary_deltas_)
+			summary_delta.reset(new petuum::SummaryDelta);
+		summary_pool_.Init(2);
+		summary_pool_.Allocate(reduced_summary_delta_);
 
 		data_.reset(new DataBlockBuffer(num_threads_));
 
@@ -50,20 +119,21 @@ namespace lda {
 		summary_row_->MutableIOBuffer().reset(new petuum::ClientSummaryRow(
 			petuum::GlobalContext::kSummaryRowID, K_));
 
-		word_topic_delta_.reset(new DeltaSlice);
-		summary_row_delta_.reset(new petuum::ClientSummaryRow(
-			petuum::GlobalContext::kSummaryRowID, K_));
-
-		vocabs_.resize(num_blocks_);
-		delta_io_threads_.resize(num_delta_threads_); // v-feigao: multi-delta threads
-		word_topic_delta_queues_.resize(num_delta_threads_);
-		for (auto& queue : word_topic_delta_queues_)
-			queue.reset(new WordTopicDeltaQueue);
-
-		delta_pool_.Init(2 * num_threads_ * num_delta_threads_); // sizeof(DeltaArray) = 48MB, 256 * 48MB = 12GB
-		summary_pool_.Init(2 * num_threads_);
+		int32_t num_delta_buffers = double_buffer_ ? 2 : 1;
+		word_topic_deltas_.resize(num_delta_buffers);
+		summary_row_deltas_.resize(num_delta_buffers);
+		for (int32_t i = 0; i < num_delta_buffers; ++i)
+		{
+			word_topic_deltas_[i].reset(new DeltaSlice);
+			summary_row_deltas_[i].reset(new petuum::ClientSummaryRow(
+				petuum::GlobalContext::kSummaryRowID, K_));
+		}
+		alias_slice_.reset(new AliasSlice);
+		curr_delta_ = 0;
+		delta_flush_time_.resize(num_delta_buffers, 0.0);
+		for (int32_t i = 1; i < num_delta_buffers; ++i)
+			free_delta_queue_.Push(i);
 
-		num_all_slice_ = 0;
 		num_tokens_clock_ = 0;
 		
 		process_barrier_.reset(new boost::barrier(num_threads_));
@@ -73,44 +143,159 @@ namespace lda {
 		app_thread_running_ = true;
 	}
 
-	void LDAEngine::Setup()
+	void LDAEngine::ReadVocabs()
 	{
 		util::Context& context = util::Context::get_instance();
 		int32_t block_offset = context.get_int32("block_offset");
 
+		// the vocabs of the blocks are read by the worker threads in parallel
+		petuum::HighResolutionTimer vocab_timer;
+		std::atomic<int32_t> next_vocab(0);
+		std::vector<std::thread> vocab_threads;
+		for (int32_t i = 0; i < (std::min)(num_threads_, num_blocks_); ++i)
+		{
+			vocab_threads.emplace_back([this, &next_vocab, block_offset]() {
+				for (int32_t id = next_vocab++; id < num_blocks_; id = next_vocab++)
+					vocabs_[id].Read(vocab_file_ + "." + std::to_string(id + block_offset));
+			});
+		}
+		for (auto& thread : vocab_threads)
+			thread.join();
+		num_all_slice_ = 0;
 		for (int32_t id = 0; id < num_blocks_; ++id) 
 		{
-			std::string vocab_file_name = vocab_file_ + "." + std::to_string(id + block_offset);
-			vocabs_[id].Read(vocab_file_name);
 			num_all_slice_ += vocabs_[id].NumOfSlice();
 			LOG(INFO) << "Block id = " << id << ". Num of slice = " << vocabs_[id].NumOfSlice();
 		}
+		LOG(INFO) << "Read the local vocabularies in " << vocab_timer.elapsed() << " seconds";
 
 		LOG(INFO) << "Load locab vocabulary OK. Number of all slice = " << num_all_slice_ 
 			<< ". Each batch has average number of slice = " 
 			<< static_cast<double>(num_all_slice_) / num_blocks_;
+	}
+
+	void LDAEngine::PlanMemory(int64_t delta_pool_size)
+	{
+		util::Context& context = util::Context::get_instance();
+
+		// the largest slice of the vocabs
+		int64_t model_slice_size = 0;
+		int64_t alias_slice_size = 0;
+		int64_t delta_slice_size = 0;
+		int32_t slice_num_words = 0;
+		int64_t vocab_memory = 0;
+		for (const LocalVocab& vocab : vocabs_)
+		{
+			for (int32_t slice_id = 0; slice_id < vocab.NumOfSlice(); ++slice_id)
+			{
+				int64_t model_size, alias_size, delta_size;
+				vocab.SliceTableSize(slice_id, &model_size, &alias_size, &delta_size);
+				model_slice_size = (std::max)(model_slice_size, model_size);
+				alias_slice_size = (std::max)(alias_slice_size, alias_size);
+				delta_slice_size = (std::max)(delta_slice_size, delta_size);
+				slice_num_words = (std::max)(slice_num_words, vocab.SliceSize(slice_id));
+			}
+			vocab_memory += vocab.MemorySize();
+		}
+
+		// the largest block, from the block file headers. The offsets of a
+		// block take one more entry than its docs.
+		int32_t block_num_docs = 0;
+		int64_t block_memory_size = 0;
+		for (int32_t id = 0; id < num_blocks_; ++id)
+		{
+			int32_t num_docs;
+			int64_t memory_size = LDADataBlock::ReadHeader(BlockFileName(id), &num_docs);
+			block_num_docs = (std::max)(block_num_docs, num_docs + 1);
+			block_memory_size = (std::max)(block_memory_size, memory_size);
+		}
+		// block_size and block_max_capacity only bound the blocks now
+		int32_t max_block_docs = context.get_int32("block_size");
+		int64_t max_block_memory = context.get_int64("block_max_capacity");
+		CHECK(max_block_docs == 0 || block_num_docs <= max_block_docs)
+			<< "A data block has " << block_num_docs - 1 << " docs, block_size = " << max_block_docs;
+		CHECK(max_block_memory == 0 || block_memory_size <= max_block_memory)
+			<< "A data block needs a memory block of " << block_memory_size << ", block_max_capacity = " << max_block_memory;
+
+		context.set("model_slice_size", std::to_string(model_slice_size));
+		context.set("alias_slice_size", std::to_string(alias_slice_size));
+		context.set("delta_slice_size", std::to_string(delta_slice_size));
+		context.set("slice_num_words", slice_num_words);
+		context.set("block_num_docs", block_num_docs);
+		context.set("block_memory_size", std::to_string(block_memory_size));
+		LOG(INFO) << "Largest slice: " << slice_num_words << " words, model table = " << model_slice_size
+			<< ", alias table = " << alias_slice_size << ", delta table = " << delta_slice_size
+			<< ". Largest block: " << block_num_docs - 1 << " docs, memory block = " << block_memory_size;
+
+		// the model and data are double buffered
+		int64_t num_delta_buffers = double_buffer_ ? 2 : 1;
+		int64_t model_memory = 2 * (sizeof(int32_t) * model_slice_size +
+			sizeof(lda::hybrid_map) * static_cast<int64_t>(slice_num_words));
+		int64_t alias_memory = sizeof(int32_t) * alias_slice_size +
+			(sizeof(int32_t) + sizeof(real_t)) * static_cast<int64_t>(slice_num_words);
+		int64_t delta_memory = num_delta_buffers * (sizeof(int32_t) * delta_slice_size +
+			(sizeof(lda::hybrid_map) + sizeof(int32_t)) * static_cast<int64_t>(slice_num_words));
+		int64_t data_memory = 2 * (sizeof(int32_t) * block_memory_size +
+			(sizeof(int64_t) + sizeof(int32_t)) * static_cast<int64_t>(block_num_docs));
+		int64_t cache_memory = block_cache_ ? context.get_int64("data_cache_budget") * 1024 * 1024 : 0;
+		std::vector<std::pair<std::string, int64_t>> plan = {
+			{ "model slices", model_memory },
+			{ "alias slice", alias_memory },
+			{ "delta slices", delta_memory },
+			{ "data blocks", data_memory },
+			{ "block cache", cache_memory },
+			{ "delta pool", delta_pool_size },
+			{ "local vocabs", vocab_memory } };
+
+		const int64_t kMB = 1024 * 1024;
+		int64_t total_memory = 0;
+		for (auto& component : plan)
+		{
+			LOG(INFO) << "Memory plan: " << component.first << " = " << component.second / kMB << " MB";
+			total_memory += component.second;
+		}
+		int64_t page_size = sysconf(_SC_PAGESIZE);
+		int64_t physical_memory = page_size * sysconf(_SC_PHYS_PAGES);
+		int64_t available_memory = page_size * sysconf(_SC_AVPHYS_PAGES);
+		LOG(INFO) << "Memory plan: total = " << total_memory / kMB << " MB. Physical memory = " 
+			<< physical_memory / kMB << " MB, available = " << available_memory / kMB << " MB";
+		CHECK_LE(total_memory, physical_memory) << "The memory plan does not fit in the physical memory, "
+			<< "lower model/alias/delta_max_capacity or generate smaller blocks";
+		if (total_memory > available_memory)
+		{
+			LOG(WARNING) << "The memory plan exceeds the available memory";
+		}
+	}
+
+	void LDAEngine::Setup()
+	{
+		if (balanced_shard_) delta_shard_balancer_.Init(vocabs_, num_delta_threads_);
 
 		data_io_thread_ = std::thread(&LDAEngine::DataIOThreadFunc, this);
 		model_io_thread_ = std::thread(&LDAEngine::ModelIOThreadFunc, this);
 		for (auto& thread : delta_io_threads_) // v-feigao: multi-delta threads
 			thread = std::thread(&LDAEngine::DeltaIOThreadFunc, this);
+		if (double_buffer_)
+			delta_flush_thread_ = std::thread(&LDAEngine::DeltaFlushThreadFunc, this);
 	}
 
 	void LDAEngine::DataIOThreadFunc()
 	{
 		VLOG(0) << "Enter DataIOThreadFunc";
 		util::Context& context = util::Context::get_instance();
-		int32_t block_offset = context.get_int32("block_offset");
 		int32_t iteration = context.get_int32("num_iterations");
+		int32_t dump_model_interval = context.get_int32("dump_model_interval");
 
-		int32_t block_id = 0;
-		std::string block_file = db_file_ + "." + std::to_string(block_id + block_offset);
+		// every block once per iteration, plus block 0 for iteration 0
+		int32_t num_reads = num_blocks_ > 1 ? (iteration + 1) * num_blocks_ : 1;
+		int32_t read_index = 0;
+		int32_t prefetch_index = 0;
 		{
 			BufferGuard<DataBlockBuffer> buffer_guard(*data_, 0);
 			std::unique_ptr<LDADataBlock>& data_block = data_->MutableIOBuffer();
 			double read_begin = lda::get_time();
 
-			data_block->Read(block_file);
+			ReadDataBlock(*data_block, read_index++, num_reads, prefetch_index);
 
 			double read_end = lda::get_time();
 			LOG(INFO) << "Read time = " << read_end - read_begin << " seconds.";
@@ -129,28 +314,81 @@ namespace lda {
 				}
 
 				std::unique_ptr<LDADataBlock>& data_block = data_->MutableIOBuffer();
-				if (data_block->HasRead()) 
+				if (data_block && data_block->HasRead()) 
 				{
-					double write_begin = lda::get_time();
-					data_block->Write();
-					double write_end = lda::get_time();
-					LOG(INFO) << "Write time = " << write_end - write_begin << " seconds.";
+					// the buffer holds the block read two reads before
+					int32_t done_index = read_index - 2;
+					int32_t done_block = done_index % num_blocks_;
+					if (block_cache_ && block_cache_->Put(done_block, data_block))
+					{
+						// resident blocks are saved along with the model dumps
+						int32_t pass = done_index / num_blocks_;
+						if (dump_model_interval > 0 && (pass + 1) % dump_model_interval == 0)
+						{
+							double write_begin = lda::get_time();
+							block_cache_->Persist(done_block, data_io_.get());
+							double write_end = lda::get_time();
+							LOG(INFO) << "Persist time = " << write_end - write_begin << " seconds.";
+						}
+					}
+					else
+					{
+						double write_begin = lda::get_time();
+						data_block->Write(data_io_.get());
+						double write_end = lda::get_time();
+						LOG(INFO) << "Write time = " << write_end - write_begin << " seconds.";
+					}
 				}
 				if (iter == iteration && block_id == num_blocks_ - 1)
 					break;
-				// Load New data;
-				int32_t next_block_id = (block_id + 1) % num_blocks_;
-				block_file = db_file_ + "." + std::to_string(next_block_id + block_offset);
-
+				// Load New data, block (block_id + 1) % num_blocks_;
+				if (block_cache_ && block_cache_->Take(read_index % num_blocks_, data_block))
+				{
+					++read_index;
+					continue;
+				}
+				if (block_cache_) block_cache_->Reuse(data_block);
 				double read_begin = lda::get_time();
-				data_block->Read(block_file);
+				ReadDataBlock(*data_block, read_index++, num_reads, prefetch_index);
 				double read_end = lda::get_time();
 				LOG(INFO) << "Read time = " << read_end - read_begin << " seconds.";
 			}
 		}
+		if (block_cache_)
+		{
+			double write_begin = lda::get_time();
+			block_cache_->Write(data_io_.get());
+			double write_end = lda::get_time();
+			LOG(INFO) << "Block cache write time = " << write_end - write_begin << " seconds.";
+		}
 		VLOG(0) << "Exit DataIOThreadFunc";
 	}
 
+	void LDAEngine::ReadDataBlock(LDADataBlock& data_block, int32_t read_index,
+		int32_t num_reads, int32_t& prefetch_index)
+	{
+		if (!block_prefetcher_)
+		{
+			data_block.Read(BlockFileName(read_index));
+			return;
+		}
+		// a block is admitted in the block cache before its next read is
+		// prefetched
+		for (; prefetch_index < num_reads && prefetch_index < read_index + block_prefetcher_->Depth(); ++prefetch_index)
+			if (!block_cache_ || !block_cache_->Resident(prefetch_index % num_blocks_))
+				block_prefetcher_->Prefetch(BlockFileName(prefetch_index));
+
+		std::string block_file = BlockFileName(read_index);
+		int64_t size;
+		const char* data = block_prefetcher_->Take(block_file, size);
+		data_block.Read(block_file, data, size);
+	}
+
+	std::string LDAEngine::BlockFileName(int32_t read_index) const
+	{
+		return db_file_ + "." + std::to_string(read_index % num_blocks_ + block_offset_);
+	}
+
 	void LDAEngine::ModelIOThreadFunc() 
 	{
 		VLOG(0) << "Enter ModelIOThreadFunc";
@@ -189,7 +427,7 @@ namespace lda {
 					std::unique_ptr<petuum::ClientSummaryRow>& summary_row =
 						summary_row_->MutableIOBuffer();
 
-					util::MtQueueMove<std::unique_ptr<petuum::ServerPushOpLogIterationMsg>> 
+					util::SpscRingQueue<std::unique_ptr<petuum::ServerPushOpLogIterationMsg>> 
 						*server_model_slice_queue = petuum::TableGroup::GetServerDeltaQueue();
 
 					//(v-feigao) : new model slice request msg
@@ -251,6 +489,8 @@ namespace lda {
 						<< ". Non-zero entries = " << num_nonzero_entries;
 					LOG(INFO) << "Global TF sum = " << global_tf_sum;
 					LOG(INFO) << "Local TF sum = " << local_tf_sum;
+					LOG(INFO) << "Queue wait time: server reply pop = " << server_model_slice_queue->PopWaitTime();
+					server_model_slice_queue->ResetWaitTime();
 				} // end for slice_id
 			} // end for batch_id
 		}// end while
@@ -265,8 +505,10 @@ namespace lda {
 		VLOG(0) << "Enter DeltaIOThreadFunc";
 		int32_t delta_thread_id = delta_thread_counter_++; // v-feigao: multi-delta threads
 
-		if (delta_thread_id == 0) // v-feigao: multi-delta threads
-			petuum::TableGroup::RegisterThread(); // only one thread serialize and send
+		// only threads that serialize and send
+		bool delta_sender = !double_buffer_ && (delta_thread_id == 0 || parallel_send_);
+		if (delta_sender) // v-feigao: multi-delta threads
+			petuum::TableGroup::RegisterThread();
 
 		process_barrier_all_->wait();
 		delta_inited_ = false;
@@ -308,24 +550,16 @@ namespace lda {
 			{
 				std::lock_guard<std::mutex> lock_guard(delta_mutex_);
 				if (delta_inited_) break;
-				word_topic_delta_->Init(&local_vocab, slice_id);
+				word_topic_deltas_[curr_delta_]->Init(&local_vocab, slice_id);
 				delta_inited_ = true;
 			}
             //LOG(INFO)<<"==here1DeltaIO pops";
 
 			petuum::HighResolutionTimer merge_timer;
-			word_topic_delta_->MergeFrom(*curr_word_topic_delta);
+			word_topic_deltas_[curr_delta_]->MergeFrom(*curr_word_topic_delta, delta_thread_id);
 			delta_merge_time += merge_timer.elapsed();
 			++delta_counter;
             //LOG(INFO)<<"==here2DeltaIO pops";
-			
-			std::unique_ptr<petuum::SummaryDelta> curr_summary_row_delta;
-			if (delta_thread_id == 0) // v-feigao: only thread 0 care about summary delta	
-			{ 
-				summary_delta_queue_.Pop(curr_summary_row_delta);
-				summary_row_delta_->MergeFrom(*curr_summary_row_delta);
-			}
-            //LOG(INFO)<<"==here3DeltaIO pops";
 
 			if (curr_word_topic_delta->Clock())
 			{
@@ -333,29 +567,96 @@ namespace lda {
 				int32_t new_clock = app_vector_clock.Tick(curr_word_topic_delta->ThreadId());
 				if (new_clock) 
 				{
+					if (delta_thread_id == 0) // v-feigao: only thread 0 care about summary delta	
+					{
+						// one reduced summary delta per slice
+						std::unique_ptr<petuum::SummaryDelta> curr_summary_row_delta;
+						summary_delta_queue_.Pop(curr_summary_row_delta);
+						summary_row_deltas_[curr_delta_]->MergeFrom(*curr_summary_row_delta);
+						summary_pool_.Free(curr_summary_row_delta);
+					}
 					process_barrier_delta_->wait();
-					if (delta_thread_id == 0) {
-						bool is_iteration_clock = false;
-
-						if (++clock_num == num_all_slice_) 
+					if (double_buffer_)
+					{
+						if (delta_thread_id == 0)
 						{
-							is_iteration_clock = true;
-							clock_num = 0;
+							DeltaFlushJob job;
+							job.buffer = curr_delta_;
+							job.batch_id = batch_id;
+							job.slice_id = slice_id;
+							job.is_iteration_clock = false;
+							if (++clock_num == num_all_slice_)
+							{
+								job.is_iteration_clock = true;
+								clock_num = 0;
+							}
+							job.num_delta_entries = num_delta_clock_;
+							delta_flush_queue_.Push(job);
+
+							// blocks while the previous slice is still being sent
+							petuum::HighResolutionTimer wait_timer;
+							free_delta_queue_.Pop(curr_delta_);
+							double wait_time = wait_timer.elapsed();
+							double flush_time = delta_flush_time_[curr_delta_];
+							LOG(INFO) << "Word topic table stat: numner = " << delta_counter
+								<< ". merge_time = " << delta_merge_time;
+							LOG(INFO) << "Delta double buffer: last flush time = " << flush_time
+								<< ". overlapped with merge = " << (std::max)(0.0, flush_time - wait_time)
+								<< ". merge blocked = " << wait_time;
+							LogQueueWaitTime();
+							num_delta_clock_ = 0;
+							delta_inited_ = false;
+						}
+						else
+						{
+							LOG(INFO) << "Delta thread " << delta_thread_id << " stat: number = " << delta_counter
+								<< ". merge_time = " << delta_merge_time;
 						}
+					}
+					else
+					{
+						DeltaSlice& word_topic_delta = *word_topic_deltas_[0];
+						petuum::ClientSummaryRow& summary_row_delta = *summary_row_deltas_[0];
+						if (delta_thread_id == 0) {
+							if (balanced_shard_)
+								delta_shard_balancer_.Update(batch_id, slice_id, word_topic_delta.RowLoad());
 
-						summary_row_delta_->ClientCreateSendTableDeltaMsg(DeltaSendMsg);
+							summary_row_delta.ClientCreateSendTableDeltaMsg(DeltaSendMsg);
+						}
 
 						petuum::HighResolutionTimer delta_send_timer;
-						int64_t nonzero_entries = 
-							word_topic_delta_->ClientCreateSendTableDeltaMsg(DeltaSendMsg, is_iteration_clock);
-						LOG(INFO) << "Word topic table stat: numner = " << delta_counter
-							<< ". merge_time = " << delta_merge_time
-							<< ". send time = " << delta_send_timer.elapsed();
-
-						LOG(INFO) << "Num of delta entries = " << num_delta_clock_ << "\t Num of aggregated nonzero entries = " << nonzero_entries;
-						num_delta_clock_ = 0;
-						summary_row_delta_->Reset();
-						delta_inited_ = false;
+						if (delta_sender)
+							word_topic_delta.SerializeSendTableDelta(delta_thread_id, DeltaSendMsg);
+						if (parallel_send_)
+							process_barrier_delta_->wait();
+
+						if (delta_thread_id == 0) {
+							bool is_iteration_clock = false;
+
+							if (++clock_num == num_all_slice_) 
+							{
+								is_iteration_clock = true;
+								clock_num = 0;
+							}
+
+							int64_t nonzero_entries = 
+								word_topic_delta.FinishSendTableDelta(DeltaSendMsg, is_iteration_clock, num_table_msgs_);
+							LOG(INFO) << "Word topic table stat: numner = " << delta_counter
+								<< ". merge_time = " << delta_merge_time
+								<< ". send time = " << delta_send_timer.elapsed();
+
+							LOG(INFO) << "Num of delta entries = " << num_delta_clock_ << "\t Num of aggregated nonzero entries = " << nonzero_entries;
+							LogQueueWaitTime();
+							num_delta_clock_ = 0;
+							summary_row_delta.Reset();
+							delta_inited_ = false;
+						}
+						else
+						{
+							LOG(INFO) << "Delta thread " << delta_thread_id << " stat: number = " << delta_counter
+								<< ". merge_time = " << delta_merge_time
+								<< ". send time = " << delta_send_timer.elapsed();
+						}
 					}
 					delta_merge_time = 0.0; delta_counter = 0;
 					++iter;
@@ -365,15 +666,128 @@ namespace lda {
             //LOG(INFO)<<"==here5DeltaIO pops";
             //LOG(INFO)<<"DeltaIO changes delta_poop_";
 			delta_pool_.Free(curr_word_topic_delta);
-			if (delta_thread_id == 0) summary_pool_.Free(curr_summary_row_delta);
 		}
         //LOG(INFO)<<"DeltaIO prepares to deregister";	
-		if (delta_thread_id == 0) {
+		if (delta_sender) {
 			petuum::TableGroup::DeregisterThread();
 		}
 		VLOG(0) << "Exit DeltaIOThreadFunc";
 	}
 
+	void LDAEngine::DeltaFlushThreadFunc()
+	{
+		VLOG(0) << "Enter DeltaFlushThreadFunc";
+		petuum::TableGroup::RegisterThread();
+
+		DeltaFlushJob job;
+		while (delta_flush_queue_.Pop(job))
+		{
+			DeltaSlice& word_topic_delta = *word_topic_deltas_[job.buffer];
+			petuum::ClientSummaryRow& summary_row_delta = *summary_row_deltas_[job.buffer];
+			petuum::HighResolutionTimer delta_send_timer;
+
+			if (balanced_shard_)
+				delta_shard_balancer_.Update(job.batch_id, job.slice_id, word_topic_delta.RowLoad());
+
+			summary_row_delta.ClientCreateSendTableDeltaMsg(DeltaSendMsg);
+			word_topic_delta.SerializeSendTableDelta(0, DeltaSendMsg);
+			int64_t nonzero_entries = 
+				word_topic_delta.FinishSendTableDelta(DeltaSendMsg, job.is_iteration_clock, num_table_msgs_);
+			summary_row_delta.Reset();
+
+			delta_flush_time_[job.buffer] = delta_send_timer.elapsed();
+			LOG(INFO) << "Delta flush thread: send time = " << delta_flush_time_[job.buffer];
+			LOG(INFO) << "Num of delta entries = " << job.num_delta_entries << "\t Num of aggregated nonzero entries = " << nonzero_entries;
+			free_delta_queue_.Push(job.buffer);
+		}
+
+		petuum::TableGroup::DeregisterThread();
+		VLOG(0) << "Exit DeltaFlushThreadFunc";
+	}
+
+	void LDAEngine::LogQueueWaitTime()
+	{
+		double delta_push_wait = 0.0, delta_pop_wait = 0.0;
+		for (auto& queue : word_topic_delta_queues_)
+		{
+			delta_push_wait += queue->PushWaitTime();
+			delta_pop_wait += queue->PopWaitTime();
+			queue->ResetWaitTime();
+		}
+		LOG(INFO) << "Queue wait time: delta queue push = " << delta_push_wait
+			<< "\tdelta queue pop = " << delta_pop_wait
+			<< "\tsummary queue pop = " << summary_delta_queue_.PopWaitTime();
+		summary_delta_queue_.ResetWaitTime();
+		delta_pool_.Shrink();
+		delta_pool_.LogStats("Delta");
+		summary_pool_.LogStats("Summary");
+	}
+
+	void LDAEngine::ReduceSummaryDelta(int32_t thread_id)
+	{
+		petuum::HighResolutionTimer idle_timer;
+		process_barrier_->wait();
+		barrier_idle_time_[thread_id - 1] = idle_timer.elapsed();
+		int32_t topic_begin = static_cast<int32_t>(static_cast<int64_t>(K_) * (thread_id - 1) / num_threads_);
+		int32_t topic_end = static_cast<int32_t>(static_cast<int64_t>(K_) * thread_id / num_threads_);
+		reduced_summary_delta_->ReduceFrom(worker_summary_deltas_, topic_begin, topic_end);
+		process_barrier_->wait();
+		if (thread_id == 1)
+		{
+			summary_delta_queue_.Push(reduced_summary_delta_);
+			summary_pool_.Allocate(reduced_summary_delta_);
+		}
+	}
+
+	void LDAEngine::InitWorkerDelta(WorkerDelta& worker_delta)
+	{
+		worker_delta.arrays.resize(num_delta_threads_);
+		if (delta_aggregation_)
+		{
+			// one flush must fit in one delta array
+			int32_t max_entries = petuum::DeltaAggregator::kDefaultMaxEntries;
+			max_entries = (std::min)(max_entries, delta_array_capacity_ / 2);
+			worker_delta.aggregators.resize(num_delta_threads_);
+			for (auto& delta_aggregator : worker_delta.aggregators)
+				delta_aggregator.reset(new petuum::DeltaAggregator(max_entries));
+		}
+		else
+		{
+			for (auto& word_topic_delta : worker_delta.arrays)
+				delta_pool_.Allocate(word_topic_delta);
+		}
+	}
+
+	bool LDAEngine::WorkerDeltaFits(WorkerDelta& worker_delta, int32_t shard_id, int32_t doc_size)
+	{
+		return delta_aggregation_ ? worker_delta.aggregators[shard_id]->ValidDocSize(doc_size)
+			: worker_delta.arrays[shard_id]->ValidDocSize(doc_size);
+	}
+
+	void LDAEngine::UpdateWorkerDelta(WorkerDelta& worker_delta, int32_t shard_id,
+		int32_t word, int32_t topic)
+	{
+		if (delta_aggregation_)
+			worker_delta.aggregators[shard_id]->Update(word, topic, 1);
+		else
+			worker_delta.arrays[shard_id]->Update(word, topic, 1);
+	}
+
+	void LDAEngine::FlushWorkerDelta(WorkerDelta& worker_delta, int32_t shard_id,
+		int32_t thread_id, int32_t iter, int32_t batch_id, int32_t slice_id, bool is_last)
+	{
+		auto& word_topic_delta = worker_delta.arrays[shard_id];
+		if (delta_aggregation_)
+		{
+			delta_pool_.Allocate(word_topic_delta);
+			worker_delta.aggregators[shard_id]->FlushTo(*word_topic_delta);
+		}
+		word_topic_delta->SetProperty(thread_id, iter, batch_id, slice_id, is_last);
+		word_topic_delta_queues_[shard_id]->Push(word_topic_delta);
+		CHECK(!word_topic_delta.get()) << "unique Pointer should not own memory";
+		if (!delta_aggregation_) delta_pool_.Allocate(word_topic_delta);
+	}
+
 	void LDAEngine::DeltaSendMsg(int32_t server_id, 
 		petuum::ClientSendOpLogIterationMsg* msg, 
 		bool is_clock, 
@@ -430,11 +844,9 @@ namespace lda {
 
 		int iter = 0;
 
-		std::vector<std::unique_ptr<petuum::DeltaArray>> word_topic_delta_vec(num_delta_threads_); 
-		std::unique_ptr<petuum::SummaryDelta> summary_delta;   
-		for (auto& word_topic_delta : word_topic_delta_vec)
-			delta_pool_.Allocate(word_topic_delta);
-		summary_pool_.Allocate(summary_delta);
+		WorkerDelta worker_delta;
+		InitWorkerDelta(worker_delta);
+		std::unique_ptr<petuum::SummaryDelta>& summary_delta = worker_summary_deltas_[thread_id - 1];
 
 		// pass the whole data, init the model. The initialization is seen ase the Iter 0;
 		// LOG(INFO) << "Begin topic initialization in thread = " << thread_id << std::flush;
@@ -459,52 +871,53 @@ namespace lda {
                 //LOG(ERROR)<<"num of slice: " << num_of_slice;
 				for (int32_t slice_id = 0; slice_id < num_of_slice; ++slice_id)
 				{
+					if (doc_scheduler_.WorkStealing())
+					{
+						doc_scheduler_.CountTokens(*lda_data_block, thread_id - 1,
+							local_vocab.FirstWord(slice_id), local_vocab.LastWord(slice_id));
+						process_barrier_->wait();
+					}
+					if (thread_id == 1)
+					{
+						doc_scheduler_.Schedule(*lda_data_block);
+						if (balanced_shard_) delta_shard_balancer_.GetShard(batch_id, slice_id, delta_shard_);
+					}
 					process_barrier_->wait();					
 					petuum::HighResolutionTimer iter_timer;
 					int32_t num_tokens = 0;
-					int32_t doc_begin = lda_data_block->Begin(thread_id - 1);
-					int32_t doc_end = lda_data_block->End(thread_id - 1);
-					for (int32_t doc_index = doc_begin;
-						doc_index != doc_end;
-						++doc_index) 
+					int32_t doc_begin, doc_end;
+					while (doc_scheduler_.NextChunk(thread_id - 1, doc_begin, doc_end))
+					for (LDADocument doc : lda_data_block->Docs(doc_begin, doc_end)) 
 					{
-						std::shared_ptr<LDADocument> doc = lda_data_block->GetOneDoc(doc_index);
-						for (int32_t i = 0; i < word_topic_delta_vec.size(); ++i) 
+						for (int32_t i = 0; i < num_delta_threads_; ++i) 
 						{
-							auto& word_topic_delta = word_topic_delta_vec[i];
-							
-							if (!word_topic_delta->ValidDocSize(doc->size()))
-							{
-								word_topic_delta->SetProperty(thread_id, iter, batch_id, slice_id, false);
-								word_topic_delta_queues_[i]->Push(word_topic_delta);
-								CHECK(!word_topic_delta.get()) << "unique Pointer should not own memory";
-								delta_pool_.Allocate(word_topic_delta);
-								if (i == 0)
-								{
-									summary_delta_queue_.Push(summary_delta);
-									summary_pool_.Allocate(summary_delta);
-								}
-							}
+							if (!WorkerDeltaFits(worker_delta, i, doc.size()))
+								FlushWorkerDelta(worker_delta, i, thread_id, iter, batch_id, slice_id, false);
 						}
-						int32_t slice_last_word = local_vocab.LastWord(slice_id);
-						int32_t& cursor = doc->get_cursor();
-						if (slice_id == 0) cursor = 0;
-						for ( ; cursor != doc->size(); ++cursor)
+						// the only slice of a block takes all the tokens
+						int32_t begin = 0, end = doc.size();
+						if (num_of_slice > 1)
 						{
-							int32_t word = doc->Word(cursor);
-							if (word > slice_last_word)
-								break;
+							int32_t& cursor = doc.get_cursor();
+							if (slice_id == 0) cursor = 0;
+							begin = cursor;
+							end = doc.SliceEnd(begin, local_vocab.LastWord(slice_id));
+							cursor = end;
+						}
+						for (int32_t index = begin; index != end; ++index)
+						{
+							int32_t word = doc.Word(index);
 							
-							if (cold_start_) 
+							if (cold_start_ || doc.Topic(index) == kUnassignedTopic)
 							{
 								int32_t topic = rng.rand_k(K_);
-								doc->SetTopic(cursor, topic); 
+								doc.SetTopic(index, topic); 
 							}
 														
 							++num_tokens;
-							int32_t shard_id = word % num_delta_threads_;
-							word_topic_delta_vec[shard_id]->Update(word, doc->Topic(cursor), 1);
-							summary_delta->Update(doc->Topic(cursor), 1);
+							int32_t shard_id = delta_shard_.ShardId(word);
+							UpdateWorkerDelta(worker_delta, shard_id, word, doc.Topic(index));
+							summary_delta->Update(doc.Topic(index), 1);
 						}
 					}
 					num_tokens_clock_ += num_tokens;
@@ -514,18 +927,10 @@ namespace lda {
 							" . Tokens Num in one thread: " << num_tokens << ". Took time : " << iter_timer.elapsed();
 					}
 					//LOG(ERROR)<<"1---here"<<thread_id<<": "<<slice_id;
-					summary_delta_queue_.Push(summary_delta);
-					//LOG(ERROR)<<"1.5---here"<<thread_id<<": "<<slice_id;
-					summary_pool_.Allocate(summary_delta);
+					ReduceSummaryDelta(thread_id);
 					//LOG(ERROR)<<"2---here"<<thread_id<<": "<<slice_id;
-					for (int32_t i = 0; i < word_topic_delta_vec.size(); ++i)
-					{
-						auto& word_topic_delta = word_topic_delta_vec[i];
-						
-						word_topic_delta->SetProperty(thread_id, iter, batch_id, slice_id, true);
-						word_topic_delta_queues_[i]->Push(word_topic_delta);
-						delta_pool_.Allocate(word_topic_delta);
-					}	
+					for (int32_t i = 0; i < num_delta_threads_; ++i)
+						FlushWorkerDelta(worker_delta, i, thread_id, iter, batch_id, slice_id, true);
 					//LOG(ERROR)<<"3---here"<<thread_id<<": "<<slice_id;
 					
 					process_barrier_->wait();
@@ -570,6 +975,10 @@ namespace lda {
 
 				LocalVocab& local_vocab = vocabs_[batch_id];
 				int32_t num_of_slice = local_vocab.NumOfSlice();
+				// A block of a single slice skips the barriers that order the
+				// slices of a block, the model buffer handoff between blocks
+				// already lines the workers up
+				bool single_slice = num_of_slice == 1;
 				// for every model slice
 				for (int32_t slice_id = 0; slice_id < num_of_slice; ++slice_id)
 				{
@@ -577,20 +986,30 @@ namespace lda {
 					BufferGuard<WordTopicBuffer> word_topic_table_guard(*word_topic_table_, thread_id);
 					BufferGuard<SummaryBuffer> summary_row_guard(*summary_row_, thread_id);
 					double wait_time = wait_timer.elapsed();
-					process_barrier_->wait();
+					if (doc_scheduler_.WorkStealing())
+						doc_scheduler_.CountTokens(*lda_data_block, thread_id - 1,
+							local_vocab.FirstWord(slice_id), local_vocab.LastWord(slice_id));
+					if (!single_slice || doc_scheduler_.WorkStealing())
+						process_barrier_->wait();
 
 					petuum::HighResolutionTimer alias_timer;
 					std::unique_ptr<ModelSlice>& word_topic_table =
 						word_topic_table_->MutableWorkerBuffer();
 					std::unique_ptr<petuum::ClientSummaryRow>& summary_row =
 						summary_row_->MutableWorkerBuffer();
-					process_barrier_->wait();
-					if (thread_id == 1) alias_slice_.Init(&local_vocab, slice_id);
+					if (!single_slice)
+						process_barrier_->wait();
+					if (thread_id == 1) 
+					{
+						alias_slice_->Init(&local_vocab, slice_id);
+						if (balanced_shard_) delta_shard_balancer_.GetShard(batch_id, slice_id, delta_shard_);
+						doc_scheduler_.Schedule(*lda_data_block);
+					}
 					process_barrier_->wait();
 					// each thread generate a slice of alias table;
 
 					// FOR: test doc proposal
-					alias_slice_.GenerateAliasTable(*word_topic_table, *summary_row, thread_id - 1, rng);
+					alias_slice_->GenerateAliasTable(*word_topic_table, *summary_row, thread_id - 1, rng);
 					VLOG(0) << "Thread " << thread_id << "Finish Generate Alias Table";
 
 					process_barrier_->wait();
@@ -607,48 +1026,33 @@ namespace lda {
 					VLOG(0) << "Thread id = " << thread_id << " sample data batch = " << batch_id
 						<< " on model slice = " << slice_id;
 
-					int32_t doc_begin = lda_data_block->Begin(thread_id - 1);
-					int32_t doc_end = lda_data_block->End(thread_id - 1);
 					// sampler.zero_statistics();
-					for (int32_t doc_index = doc_begin;	doc_index != doc_end; ++doc_index) 
+					int32_t doc_begin, doc_end;
+					while (doc_scheduler_.NextChunk(thread_id - 1, doc_begin, doc_end))
+					for (LDADocument doc : lda_data_block->Docs(doc_begin, doc_end)) 
 					{
-						std::shared_ptr<LDADocument> doc = lda_data_block->GetOneDoc(doc_index);
-						for (int32_t i = 0; i < word_topic_delta_vec.size(); ++i) 
+						for (int32_t i = 0; i < num_delta_threads_; ++i) 
 						{
-							auto& word_topic_delta = word_topic_delta_vec[i];
-							auto& word_topic_delta_queue = word_topic_delta_queues_[i];
-							if (!word_topic_delta->ValidDocSize(doc->size())) 
-							{
-								word_topic_delta->SetProperty(thread_id, iter, batch_id, slice_id, false);
-								word_topic_delta_queue->Push(word_topic_delta);
-								CHECK(!word_topic_delta.get()) << "unique Pointer should not own memory";
-								delta_pool_.Allocate(word_topic_delta);
-								if (i == 0) 
-								{
-									summary_delta_queue_.Push(summary_delta);
-									summary_pool_.Allocate(summary_delta);
-								}
-							}
+							if (!WorkerDeltaFits(worker_delta, i, doc.size()))
+								FlushWorkerDelta(worker_delta, i, thread_id, iter, batch_id, slice_id, false);
 						}
 
-						num_tokens_clock_ += sampler.SampleOneDoc(
-							doc.get(), *word_topic_table, *summary_row, alias_slice_, word_topic_delta_vec, *summary_delta);
+						if (delta_aggregation_)
+							num_tokens_clock_ += sampler.SampleOneDoc(
+								&doc, *word_topic_table, *summary_row, *alias_slice_, worker_delta.aggregators, delta_shard_, *summary_delta);
+						else
+							num_tokens_clock_ += sampler.SampleOneDoc(
+								&doc, *word_topic_table, *summary_row, *alias_slice_, worker_delta.arrays, delta_shard_, *summary_delta);
 
 					}
 					// sampler.print_statistics();
 
-					for (int32_t i = 0; i < word_topic_delta_vec.size(); ++i)
-					{
-						auto& word_topic_delta = word_topic_delta_vec[i];
-						auto& word_topic_delta_queue = word_topic_delta_queues_[i];
-						word_topic_delta->SetProperty(thread_id, iter, batch_id, slice_id, true);
-						word_topic_delta_queue->Push(word_topic_delta);
-						delta_pool_.Allocate(word_topic_delta);
-					}
-					summary_delta_queue_.Push(summary_delta);
-					summary_pool_.Allocate(summary_delta);
+					ReduceSummaryDelta(thread_id);
+					for (int32_t i = 0; i < num_delta_threads_; ++i)
+						FlushWorkerDelta(worker_delta, i, thread_id, iter, batch_id, slice_id, true);
 					
-					process_barrier_->wait();
+					if (!single_slice)
+						process_barrier_->wait();
 					
 					if (thread_id == 1)
 					{
@@ -667,6 +1071,15 @@ namespace lda {
 							<< "\ttotal time: " << epoch_time 
 							<< "\telapsed time: " << elapsed_time;
 						LOG(INFO) << "Sample token number = " << num_tokens_clock_;
+						std::string idle_time, stolen_chunks;
+						for (int32_t i = 0; i < num_threads_; ++i)
+						{
+							idle_time += " " + std::to_string(barrier_idle_time_[i]);
+							stolen_chunks += " " + std::to_string(doc_scheduler_.NumStolen(i));
+						}
+						LOG(INFO) << "Barrier idle time per thread:" << idle_time;
+						if (doc_scheduler_.WorkStealing())
+							LOG(INFO) << "Stolen doc chunks per thread:" << stolen_chunks;
 						LOG(INFO) << "Sampling Thread Throughput: "
 							<< static_cast<double>(num_tokens_clock_ / num_threads_ / worker_time)
 							<< " tokens/(thread*sec)"
@@ -680,28 +1093,36 @@ namespace lda {
 							<< static_cast<double>(num_tokens_clock_  / epoch_time)
 							<< " tokens/sec";
 						num_tokens_clock_ = 0;
+						if (delta_aggregation_)
+						{
+							int64_t num_updates = 0, num_flushed = 0;
+							for (auto& delta_aggregator : worker_delta.aggregators)
+							{
+								int64_t updates, flushed;
+								delta_aggregator->GetStatistics(updates, flushed);
+								num_updates += updates; num_flushed += flushed;
+							}
+							LOG(INFO) << "Delta aggregation in thread 1: raw updates = " << num_updates 
+								<< "\tflushed entries = " << num_flushed;
+						}
 					}
-					process_barrier_->wait();
+					if (!single_slice)
+						process_barrier_->wait();
 
 					// likelihood
 					lda_stats.Init(&local_vocab, slice_id);
-					process_barrier_->wait();
+					if (!single_slice)
+						process_barrier_->wait();
 					
-					if (compute_ll_interval_ != -1 && iter % compute_ll_interval_ == 0) 
+					bool compute_llh = compute_ll_interval_ != -1 && iter % compute_ll_interval_ == 0;
+					if (compute_llh) 
 					{
-						process_barrier_->wait();
+						if (!single_slice)
+							process_barrier_->wait();
 						double thread_doc_likelihood = 0.0;
 						double thread_word_likelihood = 0.0;
 						if (slice_id == 0) { // Compute doc llh when slice_id == 0
-							int32_t doc_begin = lda_data_block->Begin(thread_id - 1);
-							int32_t doc_end = lda_data_block->End(thread_id - 1);
-							for (int32_t doc_index = doc_begin, doc_num = 0;
-								doc_index != doc_end;
-								++doc_index) {
-								std::shared_ptr<LDADocument> doc = lda_data_block->GetOneDoc(doc_index);
-								thread_doc_likelihood += lda_stats.ComputeOneDocLLH(doc.get());
-								if (++doc_num >= 10000) break;
-							}
+							thread_doc_likelihood += lda_stats.ComputeDocsLLH(lda_data_block->Docs(thread_id - 1), 10000);
 						}
 						// word_likelihood
 						
@@ -721,9 +1142,13 @@ namespace lda {
 							word_likelihood_ += thread_word_likelihood;
 						}
 					}
-					process_barrier_->wait();
+					// a single slice block only waits for the likelihood of all
+					// the threads, which thread 1 logs
+					if (!single_slice || compute_llh)
+						process_barrier_->wait();
 				}
-				process_barrier_->wait();
+				if (!single_slice)
+					process_barrier_->wait();
 				if (num_blocks_ > 1) data_->End(thread_id);
 			} // end while
 			if (thread_id == 1)
@@ -750,7 +1175,7 @@ namespace lda {
 		{
 			app_thread_running_ = false;
 			data_->Exit();
-			util::MtQueueMove<std::unique_ptr<petuum::ServerPushOpLogIterationMsg>> *server_delta_queue
+			util::SpscRingQueue<std::unique_ptr<petuum::ServerPushOpLogIterationMsg>> *server_delta_queue
 				= petuum::TableGroup::GetServerDeltaQueue();
 			server_delta_queue->Exit();
 			
@@ -762,6 +1187,11 @@ namespace lda {
 			  word_topic_delta_queue->Exit();
 			for (auto& thread : delta_io_threads_)
 				thread.join();
+			if (double_buffer_)
+			{
+				delta_flush_queue_.Exit();
+				delta_flush_thread_.join();
+			}
 		}
 
 		LOG(INFO) << "Exit AppThread = " << thread_id;
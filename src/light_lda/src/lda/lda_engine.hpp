@@ -8,20 +8,28 @@
 #include <string>
 #include <set>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include "base/common.hpp"
 #include "lda/context.hpp"
+#include "memory/block_cache.h"
+#include "memory/block_prefetcher.h"
 #include "memory/data_block.h"
 #include "memory/local_vocab.h"
 #include "memory/model_slice.h"
 #include "memory/alias_slice.h"
+#include "memory/delta_shard.h"
 #include "memory/delta_slice.h"
+#include "memory/doc_scheduler.h"
 #include "memory/summary_row.hpp"
 #include "system/ps_msgs.hpp"
+#include "util/async_io.h"
+#include "util/delta_aggregator.h"
 #include "util/delta_table.h"
 #include "util/vector_clock.hpp"
 #include "util/delta_pool.h"
 #include "util/double_buffer.h"
+#include "util/ring_queue.h"
 
 
 namespace lda {
@@ -38,13 +46,60 @@ namespace lda {
 		void Test();
 	
 	private:
+		// Reads the local vocabs of the blocks, in parallel.
+		void ReadVocabs();
+
+		// Sizes the slice tables to the largest slice of the vocabs and the
+		// data blocks to the largest block file, by setting the
+		// model/alias/delta_slice_size, slice_num_words, block_num_docs and
+		// block_memory_size entries of the context they are allocated from.
+		// Logs the memory each component takes and fails if their sum
+		// exceeds the physical memory. delta_pool_size is in bytes.
+		void PlanMemory(int64_t delta_pool_size);
+
 		void DataIOThreadFunc();
 		void ModelIOThreadFunc();
 		void DeltaIOThreadFunc();
+		void DeltaFlushThreadFunc();
+
+		// Loads the read_index-th block file the data IO thread reads, block
+		// read_index % num_blocks_. With a block prefetcher, the reads of the
+		// next data_prefetch_depth files are started first.
+		void ReadDataBlock(LDADataBlock& data_block, int32_t read_index,
+			int32_t num_reads, int32_t& prefetch_index);
+		std::string BlockFileName(int32_t read_index) const;
 
 		void RequestModelSlice(int32_t slice_id, 
 			const LocalVocab& local_vocab);
 
+		// Accumulated blocking time of the worker -> delta thread pipeline and
+		// delta pool statistics since last call.
+		void LogQueueWaitTime();
+
+		// Sums the summary deltas the workers kept during the slice, each worker
+		// thread reducing a range of topics, and hands the sum to delta thread 0.
+		// Called by all worker threads at the end of a slice. The time the worker
+		// waits for the others is kept in barrier_idle_time_.
+		void ReduceSummaryDelta(int32_t thread_id);
+
+		// The word-topic deltas a worker thread fills, one per delta thread:
+		// arrays from delta_pool_, or in delta_aggregation mode aggregators
+		// whose combined deltas are moved into an array when flushed.
+		struct WorkerDelta {
+			std::vector<std::unique_ptr<petuum::DeltaArray>> arrays;
+			std::vector<std::unique_ptr<petuum::DeltaAggregator>> aggregators;
+		};
+
+		void InitWorkerDelta(WorkerDelta& worker_delta);
+		// Whether the delta for delta thread shard_id has room for a doc.
+		bool WorkerDeltaFits(WorkerDelta& worker_delta, int32_t shard_id, int32_t doc_size);
+		void UpdateWorkerDelta(WorkerDelta& worker_delta, int32_t shard_id,
+			int32_t word, int32_t topic);
+		// Pushes the delta for delta thread shard_id to its queue and starts
+		// a new one. is_last marks the last delta of the worker for the slice.
+		void FlushWorkerDelta(WorkerDelta& worker_delta, int32_t shard_id,
+			int32_t thread_id, int32_t iter, int32_t batch_id, int32_t slice_id, bool is_last);
+
 		static void DeltaSendMsg(
 			int32_t recv_id,
 			petuum::ClientSendOpLogIterationMsg* msg,
@@ -61,6 +116,11 @@ namespace lda {
 		int32_t num_iterations_;
 		int32_t compute_ll_interval_;
 		bool cold_start_;
+		bool delta_aggregation_;
+		int32_t delta_array_capacity_;
+		bool balanced_shard_;
+		bool parallel_send_; // every delta thread serializes and sends rows of the slice delta
+		bool double_buffer_; // delta threads merge the next slice while the flush thread sends
 
 		std::mutex llh_mutex_;
 		std::thread data_io_thread_;
@@ -85,7 +145,7 @@ namespace lda {
 		std::string vocab_file_;
 		lda::Vocabs vocabs_;
 		
-		AliasSlice alias_slice_;
+		std::unique_ptr<AliasSlice> alias_slice_;
 
 		typedef DoubleBuffer<ModelSlice> WordTopicBuffer;
 		typedef DoubleBuffer<petuum::ClientSummaryRow> SummaryBuffer;
@@ -96,9 +156,44 @@ namespace lda {
 		// typedef std::pair<int32_t, std::unique_ptr<LDADataBlock>> DataBlock; 
 		typedef DoubleBuffer<LDADataBlock> DataBlockBuffer;
 		std::unique_ptr<DataBlockBuffer> data_;
-
-		std::unique_ptr<DeltaSlice> word_topic_delta_;
-		std::unique_ptr<petuum::ClientSummaryRow> summary_row_delta_;
+		int32_t block_offset_;
+		// chunked parallel block file IO, null if data_io_threads is 0
+		std::unique_ptr<util::AsyncIO> data_io_;
+		std::unique_ptr<BlockPrefetcher> block_prefetcher_;
+		// blocks kept loaded between passes, null if data_cache_budget is 0
+		std::unique_ptr<BlockCache> block_cache_;
+
+		// documents of the data block for each worker in a slice, scheduled
+		// by worker thread 1
+		DocScheduler doc_scheduler_;
+		// time each worker waited at the end of slice barrier in the last slice
+		std::vector<double> barrier_idle_time_;
+
+		// word -> delta thread of the slice being sampled, set by worker thread 1
+		DeltaShard delta_shard_;
+		DeltaShardBalancer delta_shard_balancer_;
+
+		// one buffer, or two with delta_double_buffer
+		std::vector<std::unique_ptr<DeltaSlice>> word_topic_deltas_;
+		std::vector<std::unique_ptr<petuum::ClientSummaryRow>> summary_row_deltas_;
+		int32_t curr_delta_; // buffer the delta threads merge into, switched by delta thread 0
+		// server id -> word topic msgs this client sent since start, across
+		// all delta buffers, see ClientSendOpLogIterationMsg
+		std::unordered_map<int32_t, int32_t> num_table_msgs_;
+
+		// delta_double_buffer: delta thread 0 hands the buffer of a finished
+		// slice to the flush thread, which gives it back once sent
+		struct DeltaFlushJob {
+			int32_t buffer;
+			int32_t batch_id;
+			int32_t slice_id;
+			bool is_iteration_clock;
+			int64_t num_delta_entries;
+		};
+		std::thread delta_flush_thread_;
+		util::RingQueue<DeltaFlushJob> delta_flush_queue_;
+		util::RingQueue<int32_t> free_delta_queue_;
+		std::vector<double> delta_flush_time_; // send time of the last flush of each buffer
 
 		int32_t num_blocks_;
 		int32_t num_all_slice_;
@@ -106,10 +201,15 @@ namespace lda {
 		double doc_likelihood_;
 		double word_likelihood_;
 
-		typedef util::MtQueueMove<std::unique_ptr<petuum::DeltaArray>> WordTopicDeltaQueue;
+		// many worker threads push, one delta thread pops
+		typedef util::RingQueue<std::unique_ptr<petuum::DeltaArray>> WordTopicDeltaQueue;
 		std::vector<std::unique_ptr<WordTopicDeltaQueue>> word_topic_delta_queues_; // v-feigao: multi-delta threads
 
-		util::MtQueueMove<std::unique_ptr<petuum::SummaryDelta> > summary_delta_queue_;
+		// per worker thread, reduced once per slice into reduced_summary_delta_
+		std::vector<std::unique_ptr<petuum::SummaryDelta>> worker_summary_deltas_;
+		std::unique_ptr<petuum::SummaryDelta> reduced_summary_delta_;
+		// one reduced delta per slice, bounded by summary_pool_
+		util::RingQueue<std::unique_ptr<petuum::SummaryDelta> > summary_delta_queue_;
 
 		petuum::DeltaPool<petuum::DeltaArray> delta_pool_;
 		petuum::DeltaPool<petuum::SummaryDelta> summary_pool_;
@@ -17,11 +17,24 @@ DEFINE_int32(client_id, 0, "Client ID");
 DEFINE_int32(num_worker_threads, 1, "Number of app threads in this client");
 DEFINE_int32(num_delta_threads, 1, "Number of delta threads in this client");
 //DEFINE_int32(num_server_threads, 1, "Number of server threads in this client");
-DEFINE_bool(cold_start, true, "cold start or warm start");
+DEFINE_bool(cold_start, true, "cold start, or warm start from the topics saved in the data blocks, the tokens of appended docs getting random topics");
 DEFINE_int32(staleness, 0, "staleness for SSP");
+DEFINE_bool(delta_radix_merge, false, "partition each delta array by row memory region before merging it");
+DEFINE_bool(delta_balanced_shard, false, "assign contiguous word ranges of equal measured load to delta threads instead of word % num_delta_threads");
+DEFINE_bool(delta_parallel_send, false, "all delta threads serialize and send the slice delta instead of delta thread 0 alone");
+DEFINE_bool(delta_double_buffer, false, "merge the next slice delta while a flush thread sends the previous one, takes twice the delta memory");
+DEFINE_bool(delta_aggregation, false, "combine word-topic deltas in worker threads before pushing them to delta threads");
 
 // Input data Parameters
 DEFINE_int32(num_blocks, 1, "Number of blocks of training data");
+DEFINE_bool(data_block_mmap, false, "map the data blocks from disk and update their topics in place instead of reading and rewriting each block on every pass");
+DEFINE_bool(data_block_compress, false, "store the data blocks with delta+varint coded word ids and bit-packed topics, blocks are converted on their first write back");
+DEFINE_int32(data_io_threads, 0, "number of threads reading and writing block files in parallel chunks, 0 means synchronous block IO");
+DEFINE_int32(data_prefetch_depth, 0, "number of block files read ahead of the one being loaded, needs data_io_threads > 0");
+DEFINE_bool(data_direct_io, false, "read block files with O_DIRECT, bypassing the page cache, needs data_io_threads > 0");
+DEFINE_bool(doc_work_stealing, false, "hand out documents to worker threads in chunks balanced by tokens in the slice, idle workers steal chunks of others");
+DEFINE_int64(data_cache_budget, 0, "memory budget in MB of the data blocks kept loaded between passes instead of written back and read again, 0 means no block cache");
+DEFINE_bool(slice_meta_cache, true, "save the slice meta of each block next to its vocab file, and load it instead of generating it again when the vocab and model settings are unchanged");
 DEFINE_int32(block_offset, 0, "id of first block in this client");
 DEFINE_string(doc_file, "", "data block file name");
 DEFINE_string(vocab_file, "", "local vocabulary file name");
@@ -39,17 +52,27 @@ DEFINE_int32(compute_ll_interval, -1, "Copmute log likelihood over local dataset
 DEFINE_int32(dump_model_interval, -1, "Dump out model on every N iterations");
 
 // Pre-allocate memory Parameter
-DEFINE_int32(block_size, 1000000, "the maximum number of docs in each block");
-DEFINE_int64(block_max_capacity, 0, "size of one data block");
-DEFINE_int64(model_max_capacity, 0, "size of one slice model table");
-DEFINE_int64(alias_max_capacity, 0, "size of one slice alias table");
-DEFINE_int64(delta_max_capacity, 0, "size of one slice delta table");
+// The data blocks and slice tables are allocated at the largest block and
+// slice, the capacities below only bound them. 0 means no bound.
+DEFINE_int32(block_size, 0, "the maximum number of docs in each block");
+DEFINE_int64(block_max_capacity, 0, "maximum size of one data block");
+DEFINE_int64(model_max_capacity, 0, "maximum size of one slice model table, the vocab of a block is split into slices within it");
+DEFINE_int64(alias_max_capacity, 0, "maximum size of one slice alias table, the vocab of a block is split into slices within it");
+DEFINE_int64(delta_max_capacity, 0, "maximum size of one slice delta table, the vocab of a block is split into slices within it");
 DEFINE_int32(load_factor, 5, "load factor of light weight hash table");
+DEFINE_int32(delta_array_capacity, 0x300000, "number of word-topic deltas in one delta array, 12 bytes each");
+DEFINE_int64(delta_pool_budget, 0, "memory budget in MB of the delta pool, which may grow up to it. 0 means a fixed pool");
 
 int main(int argc, char *argv[]) {
 	google::ParseCommandLineFlags(&argc, &argv, true);
 	google::InitGoogleLogging(argv[0]);
 
+	// the flush thread of delta_double_buffer sends the whole slice delta alone
+	if (FLAGS_delta_parallel_send && FLAGS_delta_double_buffer) {
+		LOG(WARNING) << "delta_parallel_send has no effect with delta_double_buffer, "
+			<< "the delta flush thread sends alone. Turning delta_parallel_send off";
+		google::SetCommandLineOption("delta_parallel_send", "false");
+	}
 
 	// PS configuration
 	petuum::TableGroupConfig table_group_config;
@@ -67,6 +90,9 @@ int main(int argc, char *argv[]) {
 	table_group_config.num_local_app_threads = FLAGS_num_worker_threads + 1;
 	//table_group_config.num_local_app_threads = FLAGS_num_worker_threads + 2;
 	table_group_config.num_local_bg_threads = 1;
+	// delta threads (or the delta flush thread) which send to bg worker
+	table_group_config.num_delta_threads = 
+		FLAGS_delta_parallel_send ? FLAGS_num_delta_threads : 1;
 
 	petuum::GetHostInfos(FLAGS_hostfile, &table_group_config.host_map);
 	petuum::GetServerIDsFromHostMap(&(table_group_config.server_ids),
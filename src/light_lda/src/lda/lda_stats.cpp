@@ -34,12 +34,12 @@ namespace lda {
 
 	}
 
-	double LDAStats::ComputeOneDocLLH(LDADocument* doc) {
+	double LDAStats::ComputeOneDocLLH(const LDADocument& doc) {
 		double one_doc_llh = log_doc_normalizer_;
 
 		wood::light_hash_map doc_topic_counter(1024);
-		doc->GetDocTopicCounter(doc_topic_counter);
-		int num_words = doc->size();
+		doc.GetDocTopicCounter(doc_topic_counter);
+		int num_words = doc.size();
 		if (num_words == 0) 
 			return 0.0;
 		int32_t capacity = doc_topic_counter.capacity();
@@ -63,6 +63,16 @@ namespace lda {
 		return one_doc_llh;
 	}
 
+	double LDAStats::ComputeDocsLLH(LDADataBlock::DocRange docs, int32_t max_num_docs) {
+		double docs_llh = 0.0;
+		int32_t doc_num = 0;
+		for (LDADocument doc : docs) {
+			if (doc_num++ >= max_num_docs) break;
+			docs_llh += ComputeOneDocLLH(doc);
+		}
+		return docs_llh;
+	}
+
 	double LDAStats::ComputeOneSliceWordLLH(
 		ModelSlice& word_topic_table,
 		int32_t thread_id) {
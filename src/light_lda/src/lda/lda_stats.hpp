@@ -22,7 +22,10 @@ namespace lda {
 		}
 		// The i-th complete-llh calculation will use row i in llh_able_. This is
 		// part of log P(z) in eq.[3].
-		double ComputeOneDocLLH(LDADocument* doc);
+		double ComputeOneDocLLH(const LDADocument& doc);
+
+		// Sum of ComputeOneDocLLH over the first max_num_docs documents of docs.
+		double ComputeDocsLLH(LDADataBlock::DocRange docs, int32_t max_num_docs);
 
 		double ComputeOneSliceWordLLH(
 			ModelSlice& word_topic_table,
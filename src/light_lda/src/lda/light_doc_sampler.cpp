@@ -45,35 +45,47 @@ namespace lda
 		return 0;
 	}
 
+	void LightDocSampler::SliceTokens(LDADocument* doc, const ModelSlice& word_topic_table,
+		int32_t& begin, int32_t& end)
+	{
+		begin = 0;
+		end = doc->size();
+		// the only slice of a block takes all the tokens
+		if (word_topic_table.SingleSlice())
+			return;
+		int32_t& cursor = doc->get_cursor();
+		if (word_topic_table.SliceId() == 0) cursor = 0;
+		begin = cursor;
+		end = doc->SliceEnd(begin, word_topic_table.LastWord());
+		cursor = end;
+	}
+
+	template <typename WordTopicDelta>
 	int32_t LightDocSampler::SampleOneDoc(LDADocument *doc,
 		ModelSlice& word_topic_table,
 		petuum::ClientSummaryRow& summary_row,
 		AliasSlice& alias_table,
-		std::vector<std::unique_ptr<petuum::DeltaArray>>& word_topic_delta_vec,
+		std::vector<std::unique_ptr<WordTopicDelta>>& word_topic_delta_vec,
+		const DeltaShard& delta_shard,
 		petuum::SummaryDelta& summary_delta)
 	{
 		DocInit(doc);
 		int num_token = doc->size();
 		int32_t num_sampling = 0;
 		int32_t num_sampling_changed = 0;
-		int32_t slice_id = word_topic_table.SliceId();
-		int32_t slice_last_word = word_topic_table.LastWord();
-		int32_t& cursor = doc->get_cursor();
-		if (slice_id == 0) cursor = 0;
-		for (; cursor != doc->size(); ++cursor) {
+		int32_t begin, end;
+		SliceTokens(doc, word_topic_table, begin, end);
+		for (int32_t index = begin; index != end; ++index) {
 
-			int32_t word = doc->Word(cursor);
-
-			if (word > slice_last_word)
-				break;
+			int32_t word = doc->Word(index);
 
 			++num_sampling;
 			++num_sampling_;
-			int32_t old_topic = doc->Topic(cursor);
+			int32_t old_topic = doc->Topic(index);
 			int32_t new_topic = Sample2WordFirst(doc, word, old_topic, old_topic,
 				word_topic_table, summary_row, alias_table);
 			if (old_topic != new_topic) {
-				int32_t shard_id = word % word_topic_delta_vec.size();
+				int32_t shard_id = delta_shard.ShardId(word);
 				word_topic_delta_vec[shard_id]->Update(word, old_topic, -1);
 				doc_topic_counter_.inc(old_topic, -1);
 				summary_delta.Update(old_topic, -1);
@@ -82,7 +94,7 @@ namespace lda
 				doc_topic_counter_.inc(new_topic, 1);
 				summary_delta.Update(new_topic, 1);
 
-				doc->SetTopic(cursor, new_topic);
+				doc->SetTopic(index, new_topic);
 				++num_sampling_changed_;
 				++num_sampling_changed;
 			}
@@ -90,30 +102,32 @@ namespace lda
 		return num_sampling;
 	}
 
+	template int32_t LightDocSampler::SampleOneDoc<petuum::DeltaArray>(LDADocument*, 
+		ModelSlice&, petuum::ClientSummaryRow&, AliasSlice&,
+		std::vector<std::unique_ptr<petuum::DeltaArray>>&, const DeltaShard&, petuum::SummaryDelta&);
+	template int32_t LightDocSampler::SampleOneDoc<petuum::DeltaAggregator>(LDADocument*,
+		ModelSlice&, petuum::ClientSummaryRow&, AliasSlice&,
+		std::vector<std::unique_ptr<petuum::DeltaAggregator>>&, const DeltaShard&, petuum::SummaryDelta&);
+
 	void LightDocSampler::InferOneDoc(LDADocument* doc, ModelSlice& word_topic_table,
 		petuum::ClientSummaryRow& summary_row, AliasSlice& alias_table) 
 	{
 		DocInit(doc);
 		int num_token = doc->size();
 
-		int32_t slice_id = word_topic_table.SliceId();
-		int32_t slice_last_word = word_topic_table.LastWord();
-
-		int32_t& cursor = doc->get_cursor();
-		if (slice_id == 0) cursor = 0;
-		for (; cursor != doc->size(); ++cursor) {
-			int32_t word = doc->Word(cursor);
-			if (word > slice_last_word)
-				break;
+		int32_t begin, end;
+		SliceTokens(doc, word_topic_table, begin, end);
+		for (int32_t index = begin; index != end; ++index) {
+			int32_t word = doc->Word(index);
 
-			int32_t old_topic = doc->Topic(cursor);
+			int32_t old_topic = doc->Topic(index);
 			int32_t new_topic = InferWordFirst(doc, word, old_topic, old_topic,
 				word_topic_table, summary_row, alias_table);
 
 			if (old_topic != new_topic) {
 				doc_topic_counter_.inc(old_topic, -1);
 				doc_topic_counter_.inc(new_topic, 1);
-				doc->SetTopic(cursor, new_topic);
+				doc->SetTopic(index, new_topic);
 			}
 		}
 	}
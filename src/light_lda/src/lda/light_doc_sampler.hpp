@@ -12,8 +12,10 @@
 #include "base/common.hpp"
 #include "memory/alias_slice.h"
 #include "memory/data_block.h"
+#include "memory/delta_shard.h"
 #include "memory/model_slice.h"
 #include "memory/summary_row.hpp"
+#include "util/delta_aggregator.h"
 #include "util/delta_table.h"
 #include "util/light_hash_map.h"
 #include "util/rand_int_rng.h"
@@ -27,10 +29,12 @@ namespace lda
 		~LightDocSampler();
 
 		// return value: num of words sampled in current model slices
+		// WordTopicDelta is either petuum::DeltaArray or petuum::DeltaAggregator
+		template <typename WordTopicDelta>
 		int32_t SampleOneDoc(LDADocument *doc, ModelSlice& word_topic_table,
 			petuum::ClientSummaryRow& summary_row, AliasSlice& alias_table,
-			std::vector<std::unique_ptr<petuum::DeltaArray>>& word_topic_delta_vec, 
-			petuum::SummaryDelta& summary_delta);
+			std::vector<std::unique_ptr<WordTopicDelta>>& word_topic_delta_vec, 
+			const DeltaShard& delta_shard, petuum::SummaryDelta& summary_delta);
 
 		void InferOneDoc(LDADocument* doc, ModelSlice& word_topic_table,
 			petuum::ClientSummaryRow& summary_row, AliasSlice& alias_table);
@@ -56,6 +60,11 @@ namespace lda
 		}
 
 	private:
+		// Tokens [begin, end) of doc in the slice of word_topic_table. The
+		// slices of a block take the tokens in turn from the doc cursor,
+		// unless the block has a single slice.
+		void SliceTokens(LDADocument* doc, const ModelSlice& word_topic_table,
+			int32_t& begin, int32_t& end);
 
 		inline int32_t Sample2WordFirst(LDADocument *doc, int32_t w, int32_t s, int32_t old_topic,
 			ModelSlice& word_topic_table,
@@ -11,7 +11,8 @@ namespace lda {
 	AliasSlice::AliasSlice() {
 		util::Context& context = util::Context::get_instance();
 		
-		memory_block_size_ = context.get_int64("alias_max_capacity");
+		// sized to the largest slice by the memory plan of LDAEngine
+		memory_block_size_ = context.get_int64("alias_slice_size");
 		try {
 			memory_block_ = new int32_t[memory_block_size_];
 		}
@@ -28,8 +29,9 @@ namespace lda {
 		beta_k_.resize(K_);
 		beta_v_.resize(K_);
 
-		height_.resize(V_);
-		n_kw_mass_.resize(V_);
+		int32_t slice_num_words = context.get_int32("slice_num_words");
+		height_.resize(slice_num_words);
+		n_kw_mass_.resize(slice_num_words);
 	}
 
 	AliasSlice::~AliasSlice() {
@@ -0,0 +1,58 @@
+#include "memory/block_cache.h"
+#include <glog/logging.h>
+
+namespace lda {
+	BlockCache::BlockCache(int32_t num_blocks, int64_t budget) :
+		budget_(budget), used_(0), blocks_(num_blocks), resident_(num_blocks, false),
+		admitted_(num_blocks, false) {
+	}
+
+	bool BlockCache::Put(int32_t block_id, std::unique_ptr<LDADataBlock>& block) {
+		CHECK(block->HasRead());
+		if (!admitted_[block_id]) {
+			admitted_[block_id] = true;
+			int64_t size = block->MemorySize();
+			if (used_ + size <= budget_) {
+				resident_[block_id] = true;
+				used_ += size;
+				LOG(INFO) << "Block " << block_id << " stays resident, block cache uses "
+					<< (used_ >> 20) << " of " << (budget_ >> 20) << " MB";
+			}
+			else {
+				LOG(INFO) << "Block " << block_id << " of " << (size >> 20)
+					<< " MB does not fit in the block cache, stream it from disk";
+			}
+		}
+		if (!resident_[block_id]) return false;
+		CHECK(!blocks_[block_id]) << "Block " << block_id << " is already in the block cache";
+		blocks_[block_id] = std::move(block);
+		return true;
+	}
+
+	bool BlockCache::Take(int32_t block_id, std::unique_ptr<LDADataBlock>& block) {
+		if (!resident_[block_id]) return false;
+		CHECK(blocks_[block_id]) << "Block " << block_id << " is resident but in use";
+		if (block) spare_.push_back(std::move(block));
+		block = std::move(blocks_[block_id]);
+		return true;
+	}
+
+	void BlockCache::Reuse(std::unique_ptr<LDADataBlock>& block) {
+		if (block) return;
+		if (spare_.empty()) {
+			block.reset(new LDADataBlock);
+			return;
+		}
+		block = std::move(spare_.back());
+		spare_.pop_back();
+	}
+
+	void BlockCache::Persist(int32_t block_id, util::AsyncIO* io) {
+		if (blocks_[block_id]) blocks_[block_id]->Persist(io);
+	}
+
+	void BlockCache::Write(util::AsyncIO* io) {
+		for (auto& block : blocks_)
+			if (block) block->Write(io);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "memory/data_block.h"
+#include "util/async_io.h"
+
+namespace lda {
+	// Keeps data blocks loaded between passes instead of writing them back
+	// and reading them again. Blocks are admitted in the order of their first
+	// write back while their memory fits in the budget; a block that does not
+	// fit is streamed from disk for the whole run. Resident blocks are only
+	// saved by Persist. Used by the data IO thread only.
+	class BlockCache {
+	public:
+		// budget: bytes of memory the resident blocks may take, on top of the
+		// two blocks of the data double buffer
+		BlockCache(int32_t num_blocks, int64_t budget);
+
+		// Takes block, which holds block block_id done with, if the block is
+		// resident or is admitted now. block is left empty then.
+		bool Put(int32_t block_id, std::unique_ptr<LDADataBlock>& block);
+
+		// Moves resident block block_id into block, returns false if it is
+		// not resident. What block held is kept for reuse.
+		bool Take(int32_t block_id, std::unique_ptr<LDADataBlock>& block);
+
+		bool Resident(int32_t block_id) const { return resident_[block_id]; }
+
+		// Gives block a block object to read into if it is empty.
+		void Reuse(std::unique_ptr<LDADataBlock>& block);
+
+		// Saves the topics of block block_id if it is in the cache, it stays
+		// loaded.
+		void Persist(int32_t block_id, util::AsyncIO* io);
+
+		// Saves and unloads the blocks in the cache.
+		void Write(util::AsyncIO* io);
+
+	private:
+		int64_t budget_;
+		int64_t used_;
+		std::vector<std::unique_ptr<LDADataBlock>> blocks_;
+		std::vector<bool> resident_;
+		std::vector<bool> admitted_; // admission was decided
+		std::vector<std::unique_ptr<LDADataBlock>> spare_;
+
+		BlockCache(const BlockCache&);
+		void operator=(const BlockCache&);
+	};
+}
@@ -0,0 +1,88 @@
+#include "memory/block_prefetcher.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <glog/logging.h>
+
+namespace lda {
+	namespace {
+		// O_DIRECT needs the buffer, the offset and the size aligned
+		const int64_t kDirectIOAlignment = 4096;
+	}
+
+	BlockPrefetcher::BlockPrefetcher(int32_t depth, util::AsyncIO& io, bool direct_io) :
+		depth_(depth), io_(io), direct_io_(direct_io) {
+		CHECK_GT(depth, 0);
+		for (int32_t i = 0; i < depth; ++i)
+			free_.emplace_back(new FileBuffer);
+	}
+
+	BlockPrefetcher::~BlockPrefetcher() {
+		for (auto& file : in_flight_) {
+			file->batch.Wait();
+			close(file->fd);
+		}
+		for (auto& file : in_flight_) free(file->buffer);
+		for (auto& file : free_) free(file->buffer);
+		if (taken_) free(taken_->buffer);
+	}
+
+	void BlockPrefetcher::Reserve(FileBuffer& file, int64_t size) {
+		if (file.capacity >= size) return;
+		free(file.buffer);
+		file.buffer = nullptr;
+		void* buffer = nullptr;
+		CHECK_EQ(posix_memalign(&buffer, kDirectIOAlignment, size), 0) << "Fails to allocate " << size << " bytes";
+		file.buffer = reinterpret_cast<char*>(buffer);
+		file.capacity = size;
+	}
+
+	void BlockPrefetcher::Prefetch(const std::string& file_name) {
+		CHECK_LT(in_flight_.size(), depth_) << "Too many block files in flight";
+		if (free_.empty()) {
+			free_.push_back(std::move(taken_));
+		}
+		std::unique_ptr<FileBuffer> file = std::move(free_.back());
+		free_.pop_back();
+
+		file->file_name = file_name;
+		file->fd = open(file_name.c_str(), O_RDONLY | (direct_io_ ? O_DIRECT : 0));
+		if (file->fd == -1 && direct_io_ && errno == EINVAL) {
+			LOG(WARNING) << "O_DIRECT is not supported for " << file_name << ", use buffered reads";
+			direct_io_ = false;
+			file->fd = open(file_name.c_str(), O_RDONLY);
+		}
+		CHECK_NE(file->fd, -1) << "Fails to open file: " << file_name << ": " << strerror(errno);
+		struct stat file_stat;
+		CHECK_EQ(fstat(file->fd, &file_stat), 0) << "Fails to stat file: " << file_name;
+		file->size = file_stat.st_size;
+
+		int64_t read_size = direct_io_ ?
+			(file->size + kDirectIOAlignment - 1) / kDirectIOAlignment * kDirectIOAlignment : file->size;
+		Reserve(*file, read_size);
+		file->batch.Reset();
+		io_.Read(file->fd, file->buffer, read_size, 0, &file->batch);
+		in_flight_.push_back(std::move(file));
+	}
+
+	const char* BlockPrefetcher::Take(const std::string& file_name, int64_t& size) {
+		if (taken_) free_.push_back(std::move(taken_));
+		CHECK(!in_flight_.empty()) << "No block file prefetched";
+		std::unique_ptr<FileBuffer>& file = in_flight_.front();
+		CHECK_EQ(file->file_name, file_name) << "Block files are not taken in prefetch order";
+
+		file->batch.Wait();
+		close(file->fd);
+		file->fd = -1;
+		CHECK_EQ(file->batch.Error(), 0) << "Fails to read file: " << file_name << ": " << strerror(file->batch.Error());
+		CHECK_EQ(file->batch.Bytes(), file->size) << "Truncated read of file: " << file_name;
+
+		taken_ = std::move(file);
+		in_flight_.pop_front();
+		size = taken_->size;
+		return taken_->buffer;
+	}
+}
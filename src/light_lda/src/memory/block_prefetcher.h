@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "util/async_io.h"
+
+namespace lda {
+	// Reads up to |depth| block files ahead of the data IO thread into a ring
+	// of file buffers, each file read in parallel chunks by AsyncIO.
+	// Used by the data IO thread only.
+	class BlockPrefetcher {
+	public:
+		// direct_io: read with O_DIRECT into aligned buffers, bypassing the
+		// page cache. Falls back to buffered reads where it is not supported.
+		BlockPrefetcher(int32_t depth, util::AsyncIO& io, bool direct_io);
+		~BlockPrefetcher();
+
+		// Starts reading file_name. At most |depth| files are in flight, the
+		// caller must not prefetch more before taking one.
+		void Prefetch(const std::string& file_name);
+
+		// Waits for the oldest prefetched file, which must be file_name, and
+		// returns its content. Valid until the next call of Prefetch or Take.
+		const char* Take(const std::string& file_name, int64_t& size);
+
+		int32_t Depth() const { return depth_; }
+
+	private:
+		struct FileBuffer {
+			FileBuffer() : fd(-1), buffer(nullptr), capacity(0), size(0) {}
+			std::string file_name;
+			int fd;
+			char* buffer;
+			int64_t capacity;
+			int64_t size;
+			util::AsyncIO::IOBatch batch;
+		};
+
+		void Reserve(FileBuffer& file, int64_t size);
+
+		int32_t depth_;
+		util::AsyncIO& io_;
+		bool direct_io_;
+
+		std::deque<std::unique_ptr<FileBuffer>> in_flight_;
+		std::vector<std::unique_ptr<FileBuffer>> free_;
+		std::unique_ptr<FileBuffer> taken_;
+
+		BlockPrefetcher(const BlockPrefetcher&);
+		void operator=(const BlockPrefetcher&);
+	};
+}
@@ -1,15 +1,68 @@
 //#include <Windows.h>
 #include "lda/context.hpp"
 #include "memory/data_block.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 
 namespace lda {
-	LDADataBlock::LDADataBlock() : has_read_(false) {
+	namespace {
+		inline void AppendVarint(std::vector<uint8_t>& buffer, uint32_t value) {
+			while (value >= 0x80) {
+				buffer.push_back(static_cast<uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+			buffer.push_back(static_cast<uint8_t>(value));
+		}
+
+		inline uint32_t ReadVarint(const uint8_t*& p) {
+			uint32_t value = 0;
+			for (int32_t shift = 0;; shift += 7) {
+				uint8_t byte = *p++;
+				value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+				if (byte < 0x80) return value;
+			}
+		}
+
+		inline int64_t NumPackedWords(int64_t num_values, int32_t bits) {
+			return (num_values * bits + 63) / 64;
+		}
+
+		// Read-only istream buffer over a block file in memory, supports tellg.
+		class MemoryStreamBuf : public std::streambuf {
+		public:
+			MemoryStreamBuf(const char* data, int64_t size) {
+				char* begin = const_cast<char*>(data);
+				setg(begin, begin, begin + size);
+			}
+		protected:
+			pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+				if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::in))
+					return pos_type(off_type(-1));
+				return pos_type(gptr() - eback());
+			}
+		};
+	}
+
+	LDADataBlock::LDADataBlock() : has_read_(false), memory_block_(nullptr),
+		words_buffer_(nullptr), topics_buffer_(nullptr), file_format_(BlockFormat::kSplit),
+		topics_file_offset_(0), file_topic_bits_(0),
+		fd_(-1), mapped_file_(nullptr), mapped_size_(0) {
 		util::Context& context = util::Context::get_instance();
 		num_threads_ = context.get_int32("num_worker_threads");
-		max_num_document_ = context.get_int32("block_size");
-		memory_block_size_ = context.get_int64("block_max_capacity");
+		// sized to the largest block by the memory plan of LDAEngine
+		max_num_document_ = context.get_int32("block_num_docs");
+		memory_block_size_ = context.get_int64("block_memory_size");
+		mmap_ = context.get_bool("data_block_mmap");
+		output_format_ = context.get_bool("data_block_compress") ? BlockFormat::kCompressed : BlockFormat::kSplit;
+		int32_t num_topics = context.get_int32("num_topics");
+		topic_bits_ = 1;
+		while ((int64_t(1) << topic_bits_) < num_topics) ++topic_bits_;
 
-		documents_.resize(max_num_document_);
+		cursors_.resize(max_num_document_);
 
 		try{
 			offset_buffer_ = new int64_t[max_num_document_];
@@ -18,68 +71,393 @@ namespace lda {
 			LOG(FATAL) << "Bad Alloc caught: " << ba.what();
 		}
 
+		// mmap mode only needs the memory block for interleaved blocks
+		if (!mmap_) AllocateMemoryBlock();
+	}
+
+	LDADataBlock::~LDADataBlock() {
+		UnmapFile();
+		delete[] memory_block_;
+		delete[] offset_buffer_;
+	}
+
+	void LDADataBlock::AllocateMemoryBlock() {
+		if (memory_block_ != nullptr) return;
 		try{
-			documents_buffer_ = new int32_t[memory_block_size_];
+			memory_block_ = new int32_t[memory_block_size_];
 		}
 		catch (std::bad_alloc& ba) {
 			LOG(FATAL) << "Bad Alloc caught: " << ba.what();
 		}
 	}
 
-	LDADataBlock::~LDADataBlock() {
-		delete[] documents_buffer_;
-		delete[] offset_buffer_;
-	}
-
 	void LDADataBlock::Read(std::string file_name) {
 		file_name_ = file_name;
 		LOG(INFO) << "load block file " << file_name_;
 
 		std::ifstream block_file(file_name_, std::ios::in | std::ios::binary);
 		CHECK(block_file.good()) << "Fails to open file: " << file_name_;
+		Read(block_file);
+	}
 
-		block_file.read(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
+	void LDADataBlock::Read(std::string file_name, const char* data, int64_t size) {
+		file_name_ = file_name;
+		LOG(INFO) << "load block file " << file_name_ << " from memory";
+
+		MemoryStreamBuf buffer(data, size);
+		std::istream block_file(&buffer);
+		Read(block_file);
+	}
+
+	void LDADataBlock::Read(std::istream& block_file) {
+		int32_t tag;
+		block_file.read(reinterpret_cast<char*>(&tag), sizeof(int32_t));
+		if (tag == kSplitBlockTag) file_format_ = BlockFormat::kSplit;
+		else if (tag == kCompressedBlockTag) file_format_ = BlockFormat::kCompressed;
+		else file_format_ = BlockFormat::kInterleaved;
+
+		// a split block to be compressed is read once instead of mapped
+		if (file_format_ == BlockFormat::kSplit && output_format_ == BlockFormat::kSplit && mmap_) {
+			MapFile();
+		}
+		else {
+			AllocateMemoryBlock();
+			if (file_format_ == BlockFormat::kSplit) {
+				ReadSplit(block_file);
+			}
+			else if (file_format_ == BlockFormat::kCompressed) {
+				ReadCompressed(block_file);
+			}
+			else {
+				num_document_ = tag;
+				ReadInterleaved(block_file);
+			}
+		}
 		
+		std::fill(cursors_.begin(), cursors_.begin() + num_document_, 0);
+		has_read_ = true;
+	}
+
+	void LDADataBlock::ReadSplit(std::istream& block_file) {
+		block_file.read(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
 		CHECK_LT(num_document_, max_num_document_) << "offset buffer is not enough for data_block " << file_name_;
 
 		block_file.read(reinterpret_cast<char*>(offset_buffer_), 
 			sizeof(int64_t) * (num_document_ + 1)); 
-		
+
 		corpus_size_ = offset_buffer_[num_document_];
-		CHECK_LE(corpus_size_, memory_block_size_) << "memory block size if not enough for data_block " << file_name_;
-		
-		block_file.read(reinterpret_cast<char*>(documents_buffer_),
-			sizeof(int32_t)* corpus_size_);
-			
-		block_file.close();
-		
-		GenerateDocument();
-		has_read_ = true;
+		CHECK_LE(2 * corpus_size_, memory_block_size_) << "memory block size if not enough for data_block " << file_name_;
+		words_buffer_ = memory_block_;
+		topics_buffer_ = memory_block_ + corpus_size_;
+
+		block_file.read(reinterpret_cast<char*>(words_buffer_), sizeof(int32_t) * corpus_size_);
+		topics_file_offset_ = block_file.tellg();
+		block_file.read(reinterpret_cast<char*>(topics_buffer_), sizeof(int32_t) * corpus_size_);
+		CHECK(block_file.good()) << "Truncated data_block " << file_name_;
+	}
+
+	// Splits the "cursor w t w t ..." docs of an interleaved block while reading it.
+	void LDADataBlock::ReadInterleaved(std::istream& block_file) {
+		CHECK_LT(num_document_, max_num_document_) << "offset buffer is not enough for data_block " << file_name_;
+
+		block_file.read(reinterpret_cast<char*>(offset_buffer_), 
+			sizeof(int64_t) * (num_document_ + 1)); 
+
+		int64_t interleaved_size = offset_buffer_[num_document_];
+		CHECK_LE(interleaved_size, memory_block_size_) << "memory block size if not enough for data_block " << file_name_;
+		corpus_size_ = (interleaved_size - num_document_) / 2;
+		words_buffer_ = memory_block_;
+		topics_buffer_ = memory_block_ + corpus_size_;
+
+		std::vector<int32_t> doc_buffer;
+		int64_t doc_begin = offset_buffer_[0];
+		offset_buffer_[0] = 0;
+		for (int32_t index = 0; index < num_document_; ++index) {
+			int64_t doc_end = offset_buffer_[index + 1];
+			int64_t doc_size = doc_end - doc_begin;
+			CHECK_GE(doc_size, 1) << "Invalid doc in data_block " << file_name_;
+			doc_buffer.resize(doc_size);
+			block_file.read(reinterpret_cast<char*>(doc_buffer.data()), sizeof(int32_t) * doc_size);
+
+			int64_t token_begin = offset_buffer_[index];
+			int64_t num_tokens = (doc_size - 1) / 2;
+			for (int64_t i = 0; i < num_tokens; ++i) {
+				words_buffer_[token_begin + i] = doc_buffer[1 + 2 * i];
+				topics_buffer_[token_begin + i] = doc_buffer[2 + 2 * i];
+			}
+			offset_buffer_[index + 1] = token_begin + num_tokens;
+			doc_begin = doc_end;
+		}
+		CHECK(block_file.good()) << "Truncated data_block " << file_name_;
+		CHECK_EQ(offset_buffer_[num_document_], corpus_size_) << "Invalid data_block " << file_name_;
+	}
+
+	void LDADataBlock::ReadCompressed(std::istream& block_file) {
+		block_file.read(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
+		CHECK_LT(num_document_, max_num_document_) << "offset buffer is not enough for data_block " << file_name_;
+		block_file.read(reinterpret_cast<char*>(&file_topic_bits_), sizeof(int32_t));
+		CHECK(file_topic_bits_ >= 0 && file_topic_bits_ <= 32) << "Invalid data_block " << file_name_;
+
+		block_file.read(reinterpret_cast<char*>(offset_buffer_), 
+			sizeof(int64_t) * (num_document_ + 1)); 
+
+		corpus_size_ = offset_buffer_[num_document_];
+		CHECK_LE(2 * corpus_size_, memory_block_size_) << "memory block size if not enough for data_block " << file_name_;
+		words_buffer_ = memory_block_;
+		topics_buffer_ = memory_block_ + corpus_size_;
+
+		int64_t compressed_size;
+		block_file.read(reinterpret_cast<char*>(&compressed_size), sizeof(int64_t));
+		compressed_words_.resize(compressed_size);
+		block_file.read(reinterpret_cast<char*>(compressed_words_.data()), compressed_size);
+		topics_file_offset_ = block_file.tellg();
+		packed_topics_.resize(NumPackedWords(corpus_size_, file_topic_bits_));
+		block_file.read(reinterpret_cast<char*>(packed_topics_.data()), sizeof(uint64_t) * packed_topics_.size());
+		CHECK(block_file.good()) << "Truncated data_block " << file_name_;
+
+		// word ids are sorted within a doc and stored as deltas
+		const uint8_t* p = compressed_words_.data();
+		for (int32_t index = 0; index < num_document_; ++index) {
+			uint32_t word = 0;
+			for (int64_t i = offset_buffer_[index]; i < offset_buffer_[index + 1]; ++i) {
+				word += ReadVarint(p);
+				words_buffer_[i] = static_cast<int32_t>(word);
+			}
+		}
+		CHECK(p == compressed_words_.data() + compressed_size) << "Invalid data_block " << file_name_;
+
+		// topic_bits == 0 means all the topics are 0, e.g. a block that was
+		// never trained
+		const int32_t bits = file_topic_bits_;
+		const uint64_t mask = bits == 0 ? 0 : (~uint64_t(0) >> (64 - bits));
+		for (int64_t i = 0; i < corpus_size_; ++i) {
+			int64_t bit = i * bits;
+			int64_t word = bit >> 6;
+			int32_t shift = bit & 63;
+			uint64_t value = bits == 0 ? 0 : packed_topics_[word] >> shift;
+			if (shift + bits > 64) value |= packed_topics_[word + 1] << (64 - shift);
+			topics_buffer_[i] = static_cast<int32_t>(value & mask);
+		}
 	}
 
-	void LDADataBlock::Write() {
+	void LDADataBlock::PackTopics() {
+		const int32_t bits = topic_bits_;
+		packed_topics_.assign(NumPackedWords(corpus_size_, bits), 0);
+		for (int64_t i = 0; i < corpus_size_; ++i) {
+			int32_t topic = topics_buffer_[i];
+			// an out of range topic would spill into the bits of its neighbours
+			CHECK(topic >= 0 && topic < (int64_t(1) << bits)) << "Invalid topic " << topic
+				<< " in data_block " << file_name_;
+			uint64_t value = static_cast<uint32_t>(topic);
+			int64_t bit = i * bits;
+			int64_t word = bit >> 6;
+			int32_t shift = bit & 63;
+			packed_topics_[word] |= value << shift;
+			if (shift + bits > 64) packed_topics_[word + 1] |= value >> (64 - shift);
+		}
+	}
+
+	void LDADataBlock::Write(util::AsyncIO* io) {
 		CHECK(has_read_);
 		LOG(INFO) << "save block file " << file_name_;
 
-		std::string temp_file = file_name_ + ".temp";
+		if (mapped_file_ != nullptr) {
+			UnmapFile();
+			has_read_ = false;
+			return;
+		}
 
-		std::ofstream block_file(temp_file, std::ios::out | std::ios::binary);
-		CHECK(block_file.good()) << "Fails to open file: " << file_name_;
-		// write the number of docs in this block
-		block_file.write(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
-		// write the length of doc and vocabs in this block
-		block_file.write(reinterpret_cast<char*>(offset_buffer_), sizeof(int64_t) * (num_document_ + 1));
-		// write the documents word topic assignment
-		block_file.write(reinterpret_cast<char*>(documents_buffer_), sizeof(int32_t)* (corpus_size_));
-		block_file.flush();
-		block_file.close();
+		SaveTopics(io);
+		has_read_ = false;
+	}
+
+	void LDADataBlock::Persist(util::AsyncIO* io) {
+		CHECK(has_read_);
+		LOG(INFO) << "persist block file " << file_name_;
+
+		if (mapped_file_ != nullptr) {
+			CHECK_EQ(msync(mapped_file_, mapped_size_, MS_SYNC), 0) << "Fails to msync file: " << file_name_;
+			return;
+		}
+
+		SaveTopics(io);
+	}
+
+	void LDADataBlock::SaveTopics(util::AsyncIO* io) {
+		// the word ids never change, only rewrite the topics if the file
+		// layout stays the same
+		if (file_format_ == output_format_ && (output_format_ == BlockFormat::kSplit || file_topic_bits_ == topic_bits_)) {
+			WriteTopics(io);
+			return;
+		}
+
+		std::string temp_file = file_name_ + ".temp";
+		int64_t topics_file_offset = WriteFile(temp_file);
 
 		// Atomic update disk file
 		// ORIG: MoveFileExA(temp_file.c_str(), file_name_.c_str(), MOVEFILE_REPLACE_EXISTING);
         if (rename(temp_file.c_str(), file_name_.c_str())==-1) {
             LOG(FATAL) << "Moving file failed!";
         }
-		has_read_ = false;
+		// the file has the output layout now, later saves only rewrite the topics
+		file_format_ = output_format_;
+		file_topic_bits_ = topic_bits_;
+		topics_file_offset_ = topics_file_offset;
+	}
+
+	int64_t LDADataBlock::MemorySize() const {
+		int64_t size = (sizeof(int64_t) + sizeof(int32_t)) * static_cast<int64_t>(max_num_document_);
+		if (memory_block_ != nullptr) size += sizeof(int32_t) * memory_block_size_;
+		size += mapped_size_;
+		size += compressed_words_.capacity() + sizeof(uint64_t) * packed_topics_.capacity();
+		return size;
+	}
+
+	int64_t LDADataBlock::ReadHeader(const std::string& file_name, int32_t* num_document) {
+		std::ifstream block_file(file_name, std::ios::in | std::ios::binary);
+		CHECK(block_file.good()) << "Fails to open file: " << file_name;
+
+		int32_t tag;
+		block_file.read(reinterpret_cast<char*>(&tag), sizeof(int32_t));
+		int64_t offsets_begin = sizeof(int32_t);
+		if (tag == kSplitBlockTag || tag == kCompressedBlockTag) {
+			block_file.read(reinterpret_cast<char*>(num_document), sizeof(int32_t));
+			offsets_begin += sizeof(int32_t);
+			// topic_bits
+			if (tag == kCompressedBlockTag) offsets_begin += sizeof(int32_t);
+		}
+		else {
+			*num_document = tag;
+		}
+		CHECK(block_file.good() && *num_document >= 0) << "Invalid data_block " << file_name;
+
+		// the last doc offset is the number of tokens, or of int32 in the
+		// docs of an interleaved block
+		int64_t last_offset;
+		block_file.seekg(offsets_begin + sizeof(int64_t) * static_cast<int64_t>(*num_document));
+		block_file.read(reinterpret_cast<char*>(&last_offset), sizeof(int64_t));
+		CHECK(block_file.good()) << "Truncated data_block " << file_name;
+
+		if (tag != kSplitBlockTag && tag != kCompressedBlockTag) return last_offset;
+		util::Context& context = util::Context::get_instance();
+		if (tag == kSplitBlockTag && context.get_bool("data_block_mmap") && !context.get_bool("data_block_compress"))
+			return 0;
+		return 2 * last_offset;
+	}
+
+	void LDADataBlock::WriteTopics(util::AsyncIO* io) {
+		const char* topics = reinterpret_cast<char*>(topics_buffer_);
+		int64_t topics_size = sizeof(int32_t) * corpus_size_;
+		if (output_format_ == BlockFormat::kCompressed) {
+			PackTopics();
+			topics = reinterpret_cast<char*>(packed_topics_.data());
+			topics_size = sizeof(uint64_t) * packed_topics_.size();
+		}
+
+		if (io != nullptr) {
+			int fd = open(file_name_.c_str(), O_WRONLY);
+			CHECK_NE(fd, -1) << "Fails to open file: " << file_name_ << ": " << strerror(errno);
+			util::AsyncIO::IOBatch batch;
+			io->Write(fd, topics, topics_size, topics_file_offset_, &batch);
+			batch.Wait();
+			close(fd);
+			CHECK_EQ(batch.Error(), 0) << "Fails to write file: " << file_name_ << ": " << strerror(batch.Error());
+			CHECK_EQ(batch.Bytes(), topics_size) << "Fails to write file: " << file_name_;
+			return;
+		}
+
+		std::fstream block_file(file_name_, std::ios::in | std::ios::out | std::ios::binary);
+		CHECK(block_file.good()) << "Fails to open file: " << file_name_;
+		block_file.seekp(topics_file_offset_);
+		block_file.write(topics, topics_size);
+		block_file.flush();
+		CHECK(block_file.good()) << "Fails to write file: " << file_name_;
+		block_file.close();
+	}
+
+	int64_t LDADataBlock::WriteFile(const std::string& file_name) {
+		std::ofstream block_file(file_name, std::ios::out | std::ios::binary);
+		CHECK(block_file.good()) << "Fails to open file: " << file_name;
+		int64_t topics_file_offset;
+		if (output_format_ == BlockFormat::kCompressed) {
+			// write the format tag, the number of docs and the topic width
+			block_file.write(reinterpret_cast<const char*>(&kCompressedBlockTag), sizeof(int32_t));
+			block_file.write(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
+			block_file.write(reinterpret_cast<char*>(&topic_bits_), sizeof(int32_t));
+			// write the token offset of docs in this block
+			block_file.write(reinterpret_cast<char*>(offset_buffer_), sizeof(int64_t) * (num_document_ + 1));
+			// write the delta coded word ids, then the packed topics
+			compressed_words_.clear();
+			for (int32_t index = 0; index < num_document_; ++index) {
+				int32_t prev_word = 0;
+				for (int64_t i = offset_buffer_[index]; i < offset_buffer_[index + 1]; ++i) {
+					AppendVarint(compressed_words_, static_cast<uint32_t>(words_buffer_[i] - prev_word));
+					prev_word = words_buffer_[i];
+				}
+			}
+			int64_t compressed_size = compressed_words_.size();
+			block_file.write(reinterpret_cast<char*>(&compressed_size), sizeof(int64_t));
+			block_file.write(reinterpret_cast<char*>(compressed_words_.data()), compressed_size);
+			topics_file_offset = block_file.tellp();
+			PackTopics();
+			block_file.write(reinterpret_cast<char*>(packed_topics_.data()), sizeof(uint64_t) * packed_topics_.size());
+		}
+		else {
+			// write the format tag and the number of docs in this block
+			block_file.write(reinterpret_cast<const char*>(&kSplitBlockTag), sizeof(int32_t));
+			block_file.write(reinterpret_cast<char*>(&num_document_), sizeof(int32_t));
+			// write the token offset of docs in this block
+			block_file.write(reinterpret_cast<char*>(offset_buffer_), sizeof(int64_t) * (num_document_ + 1));
+			// write the word ids, then the topic assignment
+			block_file.write(reinterpret_cast<char*>(words_buffer_), sizeof(int32_t)* (corpus_size_));
+			topics_file_offset = block_file.tellp();
+			block_file.write(reinterpret_cast<char*>(topics_buffer_), sizeof(int32_t)* (corpus_size_));
+		}
+		block_file.flush();
+		CHECK(block_file.good()) << "Fails to write file: " << file_name;
+		block_file.close();
+		return topics_file_offset;
+	}
+
+	void LDADataBlock::MapFile() {
+		fd_ = open(file_name_.c_str(), O_RDWR);
+		CHECK_NE(fd_, -1) << "Fails to open file: " << file_name_ << ": " << strerror(errno);
+		struct stat file_stat;
+		CHECK_EQ(fstat(fd_, &file_stat), 0) << "Fails to stat file: " << file_name_;
+		mapped_size_ = file_stat.st_size;
+		CHECK_GE(mapped_size_, 2 * sizeof(int32_t)) << "Truncated data_block " << file_name_;
+
+		void* mapped = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+		CHECK(mapped != MAP_FAILED) << "Fails to mmap file: " << file_name_ << ": " << strerror(errno);
+		mapped_file_ = reinterpret_cast<char*>(mapped);
+		// every slice sweeps the whole block again, so read it ahead but keep it
+		madvise(mapped_file_, mapped_size_, MADV_WILLNEED);
+
+		memcpy(&num_document_, mapped_file_ + sizeof(int32_t), sizeof(int32_t));
+		CHECK_LT(num_document_, max_num_document_) << "offset buffer is not enough for data_block " << file_name_;
+		size_t header_size = 2 * sizeof(int32_t) + sizeof(int64_t) * (num_document_ + 1);
+		CHECK_LE(header_size, mapped_size_) << "Truncated data_block " << file_name_;
+		memcpy(offset_buffer_, mapped_file_ + 2 * sizeof(int32_t), sizeof(int64_t) * (num_document_ + 1));
+
+		corpus_size_ = offset_buffer_[num_document_];
+		CHECK_LE(header_size + 2 * sizeof(int32_t) * corpus_size_, mapped_size_) << "Truncated data_block " << file_name_;
+		words_buffer_ = reinterpret_cast<int32_t*>(mapped_file_ + header_size);
+		topics_buffer_ = words_buffer_ + corpus_size_;
+	}
+
+	// The page cache keeps the block, so the next pass over it does not
+	// touch the disk if memory allows. MS_ASYNC only schedules the writeback
+	// of the updated topics.
+	void LDADataBlock::UnmapFile() {
+		if (mapped_file_ == nullptr) return;
+		CHECK_EQ(msync(mapped_file_, mapped_size_, MS_ASYNC), 0) << "Fails to msync file: " << file_name_;
+		CHECK_EQ(munmap(mapped_file_, mapped_size_), 0) << "Fails to munmap file: " << file_name_;
+		close(fd_);
+		fd_ = -1;
+		mapped_file_ = nullptr;
+		mapped_size_ = 0;
+		words_buffer_ = nullptr;
+		topics_buffer_ = nullptr;
 	}
 
 	int32_t LDADataBlock::Begin(int32_t thread_id) {
@@ -94,35 +472,13 @@ namespace lda {
 		return (thread_id + 1) * num_of_one_doc;
 	}
 
-	void LDADataBlock::GenerateDocument() {
-		for (int index = 0; index < num_document_; ++index) {
-			documents_[index].reset(
-				new LDADocument(documents_buffer_ + offset_buffer_[index],
-				documents_buffer_ + offset_buffer_[index + 1]));
-		}
-	}
-
-	std::shared_ptr<LDADocument> LDADataBlock::GetOneDoc(int32_t index) {
-		CHECK(has_read_) << "Invalid data block";
-		CHECK(index < num_document_);
-		return documents_[index];
-	}
-
-	LDADocument::LDADocument(int32_t* memory_begin, int32_t* memory_end) :
-		memory_begin_(memory_begin), memory_end_(memory_end), cursor_(*memory_begin) {}
-
 	void LDADocument::ResetCursor() {
-		cursor_ = 0;
+		*cursor_ = 0;
 	}
 
-	void LDADocument::GetDocTopicCounter(wood::light_hash_map& doc_topic_counter) {
-		int32_t* p = memory_begin_ + 2;
-		int32_t num = 0;
-		while (p < memory_end_) {
-			doc_topic_counter.inc(*p, 1);
-			++p; ++p;
-			if (++num == kMaxSizeLightHash)
-				return;
+	void LDADocument::GetDocTopicCounter(wood::light_hash_map& doc_topic_counter) const {
+		for (int32_t i = 0; i < size_; ++i) {
+			doc_topic_counter.inc(topics_[i], 1);
 		}
 	}
 }
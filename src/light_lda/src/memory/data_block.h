@@ -8,21 +8,117 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <vector>
 #include <glog/logging.h>
 #include "base/common.hpp"
+#include "util/async_io.h"
 #include "util/light_hash_map.h"
 
 namespace lda {
-	class LDADocument;
+	// A view of one document of an LDADataBlock, valid while the block is
+	// loaded. It does not own memory and is cheap to copy.
+	class LDADocument {
+	public:
+		static const int32_t kMaxSizeLightHash = 512; // This is for the easy use of LightHashMap
+		
+		LDADocument(int32_t* words, int32_t* topics, int32_t num_tokens, int32_t* cursor) :
+			words_(words), topics_(topics), size_(num_tokens), cursor_(cursor) {
+			if (size_ > kMaxSizeLightHash) size_ = kMaxSizeLightHash;
+		}
+		inline int32_t size() const {
+			return size_;
+		}
+		inline int32_t& get_cursor() {
+			return *cursor_;
+		}
+		inline int32_t Word(int32_t index) const { 
+			CHECK(index < size());
+			return words_[index];  
+		}
+		inline int32_t Topic(int32_t index) const {
+			CHECK(index < size());
+			return topics_[index];
+		}
+		inline void SetTopic(int32_t index, int32_t topic) {
+			CHECK(index < size());
+			topics_[index] = topic;
+		}
+		// Number of tokens with word ids in [first_word, last_word], the word
+		// ids of a document being sorted.
+		int32_t CountWords(int32_t first_word, int32_t last_word) const {
+			return static_cast<int32_t>(std::upper_bound(words_, words_ + size_, last_word) -
+				std::lower_bound(words_, words_ + size_, first_word));
+		}
+		// Index of the first token from begin with a word id above last_word,
+		// the end of the tokens of a slice ending with last_word.
+		int32_t SliceEnd(int32_t begin, int32_t last_word) const {
+			return static_cast<int32_t>(std::upper_bound(words_ + begin, words_ + size_, last_word) - words_);
+		}
+		// should be called when sweeped over all the tokens in a document
+		void ResetCursor(); 
+		void GetDocTopicCounter(wood::light_hash_map&) const;
+		std::string DebugString() {
+			std::string result;
+			for (int i = 0; i < size(); ++i) {
+				result += std::to_string(Word(i)) + ":" + std::to_string(Topic(i)) + " ";
+			}
+			return result;
+		}
+	private:
+		int32_t* words_;
+		int32_t* topics_;
+		int32_t size_;
+		int32_t* cursor_; // the block's cursors_ entry
+	};
+	// First int32 of a block file in the split format:
+	//   kSplitBlockTag, num_document (int32),
+	//   token offset of each doc (int64 * (num_document + 1)),
+	//   word ids (int32 * num_tokens), topics (int32 * num_tokens).
+	// The interleaved format starts with the (non-negative) number of docs
+	// instead, followed by int64 offsets (num_document + 1) and "cursor w t w t ..." per doc.
+	const int32_t kSplitBlockTag = -2;
+	// First int32 of a block file in the compressed format:
+	//   kCompressedBlockTag, num_document (int32), topic_bits (int32),
+	//   token offset of each doc (int64 * (num_document + 1)),
+	//   size in bytes of the word ids (int64), word ids as varint deltas
+	//   within each doc, topics bit-packed in topic_bits bits (uint64 words).
+	const int32_t kCompressedBlockTag = -3;
+	// Topic of a token not assigned yet, written by generate_datablocks for
+	// appended docs. A warm start draws a random topic for such tokens.
+	const int32_t kUnassignedTopic = -1;
 
 	class LDADataBlock {
 	public:
 		LDADataBlock();
 		~LDADataBlock();
 
+		// Reads all block formats. Split blocks are mapped in mmap mode (unless
+		// they are to be compressed), compressed ones are decoded into the word
+		// and topic arrays.
 		void Read(std::string file_name); 
+
+		// Same as Read, from the content of the block file already in memory.
+		void Read(std::string file_name, const char* data, int64_t size);
 		
-		void Write();	
+		// Saves the topics. A block file already in the output format (split,
+		// or compressed with data_block_compress) only gets its topic array
+		// rewritten in place, otherwise it is converted to that format.
+		// In mmap mode the topics were updated in place, Write only schedules
+		// the dirty pages for writeback and unmaps the block.
+		// The in place topic rewrite is split in parallel chunks if io is given.
+		void Write(util::AsyncIO* io = nullptr);	
+
+		// Saves the topics like Write, but the block stays loaded. Mapped
+		// blocks are synced to disk.
+		void Persist(util::AsyncIO* io = nullptr);
+
+		// Bytes of memory held by the block, including its mapping.
+		int64_t MemorySize() const;
+
+		// Reads the number of docs of a block file from its header, and
+		// returns the int32 elements of the memory block Read needs for it,
+		// 0 if the block is mapped.
+		static int64_t ReadHeader(const std::string& file_name, int32_t* num_document);
 
 		bool HasRead() const { return has_read_; }
 		
@@ -32,64 +128,90 @@ namespace lda {
 		// Return the next to last document for thread thread_id
 		int32_t End(int32_t thread_id);
 
-		std::shared_ptr<LDADocument> GetOneDoc(int32_t index);
+		inline LDADocument GetOneDoc(int32_t index) {
+			CHECK(has_read_) << "Invalid data block";
+			CHECK(index < num_document_);
+			return LDADocument(words_buffer_ + offset_buffer_[index], topics_buffer_ + offset_buffer_[index],
+				static_cast<int32_t>(offset_buffer_[index + 1] - offset_buffer_[index]), &cursors_[index]);
+		}
+
+		class DocIterator {
+		public:
+			DocIterator(LDADataBlock* block, int32_t index) : block_(block), index_(index) {}
+			LDADocument operator*() const { return block_->GetOneDoc(index_); }
+			DocIterator& operator++() { ++index_; return *this; }
+			bool operator!=(const DocIterator& other) const { return index_ != other.index_; }
+		private:
+			LDADataBlock* block_;
+			int32_t index_;
+		};
+
+		// Documents [begin, end) of the block, for range-based for loops.
+		class DocRange {
+		public:
+			DocRange(LDADataBlock* block, int32_t begin, int32_t end) : block_(block), begin_(begin), end_(end) {}
+			DocIterator begin() const { return DocIterator(block_, begin_); }
+			DocIterator end() const { return DocIterator(block_, end_); }
+			int32_t size() const { return end_ - begin_; }
+		private:
+			LDADataBlock* block_;
+			int32_t begin_;
+			int32_t end_;
+		};
+
+		// Documents of thread thread_id, from Begin(thread_id) to End(thread_id)
+		DocRange Docs(int32_t thread_id) { return DocRange(this, Begin(thread_id), End(thread_id)); }
+		DocRange Docs(int32_t begin, int32_t end) { return DocRange(this, begin, end); }
+
+		int32_t NumDocuments() const { return num_document_; }
 
 	private:
-		void GenerateDocument();
+		void AllocateMemoryBlock();
+		void Read(std::istream& block_file);
+		void ReadSplit(std::istream& block_file);
+		void ReadInterleaved(std::istream& block_file);
+		void ReadCompressed(std::istream& block_file);
+		// Writes the block in output_format_, returns the offset of the topics
+		int64_t WriteFile(const std::string& file_name);
+		void SaveTopics(util::AsyncIO* io);
+		void WriteTopics(util::AsyncIO* io);
+		void PackTopics();
+		void MapFile();
+		void UnmapFile();
 
 	private:
 		std::string file_name_;
 		int32_t num_threads_;
 		bool has_read_; // equal true if LDADataBlock holds memory
 
-		// int32_t* memory_block_;
+		int32_t* memory_block_; // holds the word and topic arrays unless mapped
 		int32_t max_num_document_;
 		int64_t memory_block_size_;
 
-		std::vector<std::shared_ptr<LDADocument>> documents_;
+		std::vector<int32_t> cursors_; // sampling position in each doc
 
 		int32_t num_document_; 
-		int64_t* offset_buffer_; // offset_buffer_ size = num_document_ + 1
-		int64_t corpus_size_;
-		int32_t* documents_buffer_; // documents_buffer_ size = corpus_size_;
-	};
+		int64_t* offset_buffer_; // token offsets, size = num_document_ + 1
+		int64_t corpus_size_; // number of tokens
+		int32_t* words_buffer_; // size = corpus_size_
+		int32_t* topics_buffer_; // size = corpus_size_
+		enum class BlockFormat { kInterleaved, kSplit, kCompressed };
+		BlockFormat file_format_; // format of the block file on disk
+		BlockFormat output_format_;
+		int64_t topics_file_offset_;
 
-	class LDADocument {
-	public:
-		const int32_t kMaxSizeLightHash = 512; // This is for the easy use of LightHashMap
-		
-		LDADocument(int32_t* memory_begin, int32_t* memory_end);
-		inline int32_t size() const {
-			return (std::min)(static_cast<int32_t>((memory_end_-memory_begin_) / 2), kMaxSizeLightHash);
-		}
-		inline int32_t& get_cursor() {
-			return cursor_;
-		}
-		inline int32_t Word(int32_t index) const { 
-			CHECK(index < size());
-			return *(memory_begin_ + 1 + index * 2);  
-		}
-		inline int32_t Topic(int32_t index) const {
-			CHECK(index < size());
-			return *(memory_begin_ + 2 + index * 2);
-		}
-		inline void SetTopic(int32_t index, int32_t topic) {
-			CHECK(index < size());
-			*(memory_begin_ + 2 + index * 2) = topic;
-		}
-		// should be called when sweeped over all the tokens in a document
-		void ResetCursor(); 
-		void GetDocTopicCounter(wood::light_hash_map&);
-		std::string DebugString() {
-			std::string result;
-			for (int i = 0; i < size(); ++i) {
-				result += std::to_string(Word(i)) + ":" + std::to_string(Topic(i)) + " ";
-			}
-			return result;
-		}
-	private:
-		int32_t* memory_begin_;
-		int32_t* memory_end_;
-		int32_t& cursor_; // cursor_ is reference of *memory_begin_
+		// compressed format
+		int32_t topic_bits_; // ceil(log2(num_topics))
+		int32_t file_topic_bits_;
+		std::vector<uint8_t> compressed_words_;
+		std::vector<uint64_t> packed_topics_;
+
+		// mmap mode: the word and topic arrays point into the shared mapping
+		// of the block file, so a pass neither copies the block in nor
+		// rewrites it
+		bool mmap_;
+		int32_t fd_;
+		char* mapped_file_;
+		size_t mapped_size_;
 	};
 }
\ No newline at end of file
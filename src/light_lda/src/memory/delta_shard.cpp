@@ -0,0 +1,61 @@
+#include "memory/delta_shard.h"
+#include <glog/logging.h>
+
+namespace lda {
+
+	void DeltaShardBalancer::Init(Vocabs& vocabs, int32_t num_shards) {
+		vocabs_ = &vocabs;
+		num_shards_ = num_shards;
+		load_.resize(vocabs.size());
+		boundaries_.resize(vocabs.size());
+		for (int32_t batch_id = 0; batch_id < vocabs.size(); ++batch_id) {
+			LocalVocab& local_vocab = vocabs[batch_id];
+			load_[batch_id].resize(local_vocab.NumOfSlice());
+			boundaries_[batch_id].resize(local_vocab.NumOfSlice());
+			for (int32_t slice_id = 0; slice_id < local_vocab.NumOfSlice(); ++slice_id) {
+				std::vector<float>& load = load_[batch_id][slice_id];
+				load.resize(local_vocab.SliceSize(slice_id));
+				for (int32_t index = 0; index < load.size(); ++index)
+					load[index] = static_cast<float>(local_vocab.LocalTF(slice_id, index));
+				Split(batch_id, slice_id);
+			}
+		}
+	}
+
+	void DeltaShardBalancer::GetShard(int32_t batch_id, int32_t slice_id, DeltaShard& shard) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		shard.InitRange(boundaries_[batch_id][slice_id]);
+	}
+
+	void DeltaShardBalancer::Update(int32_t batch_id, int32_t slice_id, 
+		const std::vector<int32_t>& row_load) {
+		std::vector<float>& load = load_[batch_id][slice_id];
+		CHECK_LE(load.size(), row_load.size());
+		// exponential moving average, so one noisy pass does not move the ranges much
+		for (int32_t index = 0; index < load.size(); ++index)
+			load[index] = 0.5f * load[index] + 0.5f * row_load[index];
+		std::lock_guard<std::mutex> lock(mutex_);
+		Split(batch_id, slice_id);
+	}
+
+	void DeltaShardBalancer::Split(int32_t batch_id, int32_t slice_id) {
+		const std::vector<float>& load = load_[batch_id][slice_id];
+		LocalVocab& local_vocab = (*vocabs_)[batch_id];
+		double total = 0.0;
+		for (auto row_load : load) total += row_load;
+
+		std::vector<int32_t>& boundaries = boundaries_[batch_id][slice_id];
+		boundaries.clear();
+		double acc = 0.0;
+		int32_t index = 0;
+		for (int32_t shard = 1; shard < num_shards_; ++shard) {
+			double target = total * shard / num_shards_;
+			// a row goes to the shard its midpoint falls in
+			while (index < load.size() && acc + load[index] / 2 <= target) 
+				acc += load[index++];
+			// the first word of shard |shard|, or past the last word when the slice runs out
+			boundaries.push_back(index < load.size() ? 
+				local_vocab.IndexToWord(slice_id, index) : local_vocab.LastWord(slice_id) + 1);
+		}
+	}
+}
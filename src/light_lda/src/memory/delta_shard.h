@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "memory/local_vocab.h"
+
+namespace lda {
+	// Maps the words of the current model slice to delta threads, either by
+	// word % num_shards or by contiguous word ranges.
+	class DeltaShard {
+	public:
+		DeltaShard() : num_shards_(1) {}
+
+		void InitModulo(int32_t num_shards) {
+			num_shards_ = num_shards;
+			boundaries_.clear();
+		}
+
+		// boundaries[i] is the first word of shard i + 1
+		void InitRange(const std::vector<int32_t>& boundaries) {
+			num_shards_ = static_cast<int32_t>(boundaries.size()) + 1;
+			boundaries_ = boundaries;
+		}
+
+		inline int32_t ShardId(int32_t word) const {
+			if (boundaries_.empty()) return word % num_shards_;
+			return static_cast<int32_t>(std::upper_bound(
+				boundaries_.begin(), boundaries_.end(), word) - boundaries_.begin());
+		}
+
+		int32_t NumShards() const { return num_shards_; }
+
+	private:
+		int32_t num_shards_;
+		std::vector<int32_t> boundaries_;
+	};
+
+	// Keeps the merge load of every row of every slice and splits each slice
+	// into contiguous word ranges of about equal load. The load is seeded with
+	// the local term frequency and refined with the number of delta entries
+	// merged per row each time the slice is sampled.
+	class DeltaShardBalancer {
+	public:
+		DeltaShardBalancer() : num_shards_(1) {}
+
+		void Init(Vocabs& vocabs, int32_t num_shards);
+
+		// Thread safe with Update.
+		void GetShard(int32_t batch_id, int32_t slice_id, DeltaShard& shard);
+
+		// row_load[index] is the number of delta entries merged into row |index|
+		void Update(int32_t batch_id, int32_t slice_id, const std::vector<int32_t>& row_load);
+
+	private:
+		void Split(int32_t batch_id, int32_t slice_id);
+
+	private:
+		int32_t num_shards_;
+		Vocabs* vocabs_;
+		// [batch_id][slice_id][index]
+		std::vector<std::vector<std::vector<float>>> load_;
+		std::vector<std::vector<std::vector<int32_t>>> boundaries_;
+		std::mutex mutex_;
+	};
+}
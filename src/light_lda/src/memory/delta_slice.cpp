@@ -2,6 +2,7 @@
 // Date: 2014.10.15
 
 #include "memory/delta_slice.h"
+#include <algorithm>
 #include "memory/local_vocab.h"
 #include "system/ps_msgs.hpp"
 #include "util/delta_table.h"
@@ -10,8 +11,8 @@ namespace lda {
 
 	DeltaSlice::DeltaSlice() {
 		util::Context& context = util::Context::get_instance();
-		// 
-		memory_block_size_ = context.get_int64("delta_max_capacity");
+		// sized to the largest slice by the memory plan of LDAEngine
+		memory_block_size_ = context.get_int64("delta_slice_size");
 
 		try{
 			memory_block_ = new int32_t[memory_block_size_];
@@ -20,9 +21,9 @@ namespace lda {
 			LOG(FATAL) << "Bad Alloc caught: " << ba.what();
 		}
 
-		int32_t V = context.get_int32("num_vocabs");
+		int32_t slice_num_words = context.get_int32("slice_num_words");
 
-		table_.resize(V);
+		table_.resize(slice_num_words);
 		int32_t K = context.get_int32("num_topics");
 
 		num_delta_threads_ = context.get_int32("num_delta_threads");
@@ -31,8 +32,28 @@ namespace lda {
 			buf = new int32_t[2 * K];
 		// rehashing_buf_ = new int32_t[2 * K];
 
-		send_msg_data_size_ = kSendDeltaMsgSizeInit;
-		tmp_row_buff_size_ = kTmpRowBuffSizeInit;
+		radix_merge_ = context.get_bool("delta_radix_merge");
+		record_load_ = context.get_bool("delta_balanced_shard");
+		row_load_.resize(slice_num_words);
+		num_merge_buckets_ = static_cast<int32_t>(
+			(memory_block_size_ * sizeof(int32_t)) >> kMergeBucketShift) + 1;
+		merge_scratch_.resize(num_delta_threads_);
+		if (radix_merge_) {
+			for (auto& scratch : merge_scratch_)
+				scratch.bucket_offset.assign(num_merge_buckets_, 0);
+		}
+
+		// off with delta_double_buffer, whose delta flush thread sends alone
+		parallel_send_ = context.get_bool("delta_parallel_send");
+		// the msgs of all senders together take as much memory as those of a
+		// single sender, but a full dense row must still fit into one
+		size_t num_senders = parallel_send_ ? num_delta_threads_ : 1;
+		size_t max_row_size = 2 * sizeof(int32_t) * K + 2 * sizeof(int32_t) + sizeof(size_t);
+		send_msg_data_size_ = (std::max)(max_row_size, kSendDeltaMsgSizeInit / num_senders);
+		send_buffers_.resize(num_delta_threads_);
+		for (auto& send_buffer : send_buffers_)
+			send_buffer.reset(new SendBuffer);
+		serialize_cursor_ = 0;
 	}
 	DeltaSlice::~DeltaSlice() {
 		delete[] memory_block_;
@@ -50,13 +71,75 @@ namespace lda {
 		slice_id_ = slice_id;
 		//std::fill(memory_block_, memory_block_ + memory_block_size_, 0);
 		memset(memory_block_, 0, memory_block_size_ * sizeof(int32_t));
+		if (record_load_)
+			std::fill(row_load_.begin(), row_load_.begin() + local_vocab_->SliceSize(slice_id_), 0);
 		GenerateRow();
+		serialize_cursor_ = 0;
 	}
 
-	void DeltaSlice::MergeFrom(const petuum::DeltaArray& other) {
-
+	void DeltaSlice::MergeFrom(const petuum::DeltaArray& other, int32_t delta_thread_id) {
+		if (radix_merge_) {
+			RadixMergeFrom(other, delta_thread_id);
+			return;
+		}
+		int32_t* rehash_buf = rehashing_buf_[delta_thread_id];
 		for (int i = 0; i < other.index_; ++i) {
-			Update(other.array_[i].word_id, other.array_[i].topic_id, other.array_[i].delta);
+			int32_t index = local_vocab_->WordToIndex(slice_id_, other.array_[i].word_id);
+			table_[index].set_rehash_buf(rehash_buf);
+			table_[index].inc(other.array_[i].topic_id, other.array_[i].delta);
+			if (record_load_) ++row_load_[index];
+		}
+	}
+
+	void DeltaSlice::RadixMergeFrom(const petuum::DeltaArray& other, int32_t delta_thread_id) {
+		MergeScratch& scratch = merge_scratch_[delta_thread_id];
+		SliceMeta& dict = local_vocab_->Meta(slice_id_);
+		int32_t size = other.index_;
+		if (scratch.entries.size() < size) {
+			scratch.index.resize(size);
+			scratch.bucket.resize(size);
+			scratch.entries.resize(size);
+		}
+		std::vector<int32_t>& offset = scratch.bucket_offset;
+		std::vector<int32_t>& touched = scratch.touched;
+
+		// histogram of entries per bucket
+		for (int32_t i = 0; i < size; ++i) {
+			int32_t index = local_vocab_->WordToIndex(slice_id_, other.array_[i].word_id);
+			int32_t bucket = static_cast<int32_t>(
+				(dict[index].delta_offset_ * sizeof(int32_t)) >> kMergeBucketShift);
+			scratch.index[i] = index;
+			scratch.bucket[i] = bucket;
+			if (offset[bucket]++ == 0) touched.push_back(bucket);
+		}
+		// bucket starts, over the touched buckets only
+		std::sort(touched.begin(), touched.end());
+		int32_t begin = 0;
+		for (int32_t bucket : touched) {
+			int32_t count = offset[bucket];
+			offset[bucket] = begin;
+			begin += count;
+		}
+
+		// scatter
+		for (int32_t i = 0; i < size; ++i) {
+			MergeEntry& entry = scratch.entries[offset[scratch.bucket[i]]++];
+			entry.index = scratch.index[i];
+			entry.topic = other.array_[i].topic_id;
+			entry.delta = other.array_[i].delta;
+		}
+		for (int32_t bucket : touched)
+			offset[bucket] = 0;
+		touched.clear();
+
+		// merge bucket by bucket, each one touches a cache sized region
+		int32_t* rehash_buf = rehashing_buf_[delta_thread_id];
+		for (int32_t i = 0; i < size; ++i) {
+			const MergeEntry& entry = scratch.entries[i];
+			lda::hybrid_map& row = table_[entry.index];
+			row.set_rehash_buf(rehash_buf);
+			row.inc(entry.topic, entry.delta);
+			if (record_load_) ++row_load_[entry.index];
 		}
 	}
 
@@ -80,118 +163,102 @@ namespace lda {
 		}
 	}
 
-	int64_t DeltaSlice::ClientCreateSendTableDeltaMsg(
-		ClientSendDeltaMsgFunc SendMsg,
-		bool is_iteration_clock) {
-
-		nonzero_entries_ = 0;
+	DeltaSlice::SendBuffer::~SendBuffer() {
+		for (auto& msg : msgs)
+			delete msg.second;
+	}
 
-		std::vector<int32_t>& server_ids = petuum::GlobalContext::get_server_ids();
-		std::unordered_map<int32_t, petuum::RecordBuff> buffs;
-		std::unordered_map<int32_t, petuum::ClientSendOpLogIterationMsg*> msg_map;
+	void DeltaSlice::SerializeSendTableDelta(int32_t delta_thread_id,
+		ClientSendDeltaMsgFunc SendMsg) {
+		SendBuffer& send_buffer = *send_buffers_[delta_thread_id];
 
-		// create a message for each server
-		for (int i = 0; i < petuum::GlobalContext::get_num_servers(); ++i) {
-			int32_t server_id = server_ids[i];
-			petuum::ClientSendOpLogIterationMsg* msg = new petuum::ClientSendOpLogIterationMsg(send_msg_data_size_);
+		// one message for each server, kept across clocks since the comm bus
+		// copies the message on send
+		send_buffer.buffs.clear();
+		for (auto server_id : petuum::GlobalContext::get_server_ids()) {
+			petuum::ClientSendOpLogIterationMsg*& msg = send_buffer.msgs[server_id];
+			if (msg == nullptr)
+				msg = new petuum::ClientSendOpLogIterationMsg(send_msg_data_size_);
 			msg->get_server_id() = server_id;
 			msg->get_table_id() = petuum::GlobalContext::kWordTopicTableID;
-			msg_map[server_id] = msg;
-			buffs.insert(std::make_pair(server_id, petuum::RecordBuff(msg->get_data(), send_msg_data_size_)));
-		}
-		// VLOG(0) << "Serializing table " << table_id_;
-		// set table id
-		for (auto server_id : server_ids) {
-			petuum::RecordBuff& record_buff = buffs[server_id];
-			int32_t* table_id_ptr = record_buff.GetMemPtrInt32();
-			if (table_id_ptr == 0) {
-				//VLOG(0) << "Not enough space for table id, sent out to " << server_id;
-				SendMsg(server_id, msg_map[server_id], false, false);
-				memset((msg_map[server_id])->get_data(), 0, send_msg_data_size_);
-				record_buff.ResetOffset();
-				table_id_ptr = record_buff.GetMemPtrInt32();
-			}
-			*table_id_ptr = petuum::GlobalContext::kWordTopicTableID;
+			send_buffer.buffs.insert(std::make_pair(server_id, petuum::RecordBuff(msg->get_data(), send_msg_data_size_)));
+			*send_buffer.buffs[server_id].GetMemPtrInt32() = petuum::GlobalContext::kWordTopicTableID;
 		}
-		int failed_server_id;
-		// DeltaTable packs the data
-		// InitAppendTableToBuffs();
-		index_iter_ = 0;
-		tmp_row_buff_ = new uint8_t[tmp_row_buff_size_];
+
 		VLOG(0) << "Begin serialize delta slice";
-		bool pack_suc = AppendTableToBuffs(&buffs, failed_server_id, false);
-		while (!pack_suc) {
-			//VLOG(0) << "Not enough space for appending row, send out to " << failed_server_id;
-			petuum::RecordBuff &record_buff = buffs[failed_server_id];
-			int32_t* buff_end_ptr = record_buff.GetMemPtrInt32();
-			if (buff_end_ptr != 0) {
-				*buff_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			}
+		int32_t size = local_vocab_->SliceSize(slice_id_);
+		int32_t begin;
+		while ((begin = serialize_cursor_.fetch_add(kSerializeBlockSize)) < size) {
+			int32_t end = (std::min)(begin + kSerializeBlockSize, size);
+			AppendRowsToBuffs(send_buffer, begin, end, SendMsg);
+		}
 
-			SendMsg(failed_server_id, msg_map[failed_server_id], false, false);
-			memset((msg_map[failed_server_id])->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
-			int32_t* table_id_ptr = record_buff.GetMemPtrInt32();
-			*table_id_ptr = petuum::GlobalContext::kWordTopicTableID;
-			pack_suc = AppendTableToBuffs(&buffs, failed_server_id, true);
-		}
-		// only one table
-		for (auto server_id : server_ids) {
-			petuum::RecordBuff& record_buff = buffs[server_id];
-			int32_t* table_end_ptr = record_buff.GetMemPtrInt32();
-			if (table_end_ptr == 0) {
-				//VLOG(0) << "Not enough space for table end, send out to " << server_id;
-				SendMsg(server_id, msg_map[server_id], true, is_iteration_clock);
-				continue;
+		// delta thread 0 keeps its rows for the last msgs of the slice
+		if (delta_thread_id != 0) {
+			for (auto& buff : send_buffer.buffs) {
+				if (buff.second.GetMemUsedSize() > sizeof(int32_t)) // more than the table id
+					SendBuff(send_buffer, buff.first, SendMsg, false, false);
 			}
-			*table_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			msg_map[server_id]->get_avai_size() = buffs[server_id].GetMemUsedSize();
-			SendMsg(server_id, msg_map[server_id], true, is_iteration_clock);
-			delete msg_map[server_id];
+		}
+	}
+
+	int64_t DeltaSlice::FinishSendTableDelta(ClientSendDeltaMsgFunc SendMsg,
+		bool is_iteration_clock, std::unordered_map<int32_t, int32_t>& num_table_msgs) {
+		int64_t nonzero_entries = 0;
+		for (auto& send_buffer : send_buffers_) {
+			for (auto& num_sent : send_buffer->num_sent)
+				num_table_msgs[num_sent.first] += num_sent.second;
+			send_buffer->num_sent.clear();
+			nonzero_entries += send_buffer->nonzero_entries;
+			send_buffer->nonzero_entries = 0;
 		}
 
-		return nonzero_entries_;
+		SendBuffer& send_buffer = *send_buffers_[0];
+		for (auto server_id : petuum::GlobalContext::get_server_ids()) {
+			// the server applies the clock once it has all msgs sent before it
+			send_buffer.msgs[server_id]->get_num_table_msgs() = ++num_table_msgs[server_id];
+			SendBuff(send_buffer, server_id, SendMsg, true, is_iteration_clock);
+		}
+		send_buffer.num_sent.clear();
+		return nonzero_entries;
 	}
 
-	bool DeltaSlice::AppendTableToBuffs(
-		std::unordered_map<int32_t, petuum::RecordBuff>* buffs,
-		int32_t& failed_server_id, bool resume) {
-		if (resume) {
-			int32_t row_id = local_vocab_->IndexToWord(slice_id_, index_iter_);
-			bool append_row_suc = AppendRowToBuffs(buffs,
-				tmp_row_buff_, curr_row_size_, row_id, failed_server_id);
-			if (!append_row_suc) return false;
-			++index_iter_;
-		}
-		for (; index_iter_ != local_vocab_->SliceSize(slice_id_); ++index_iter_) {
-			int32_t row_id = local_vocab_->IndexToWord(slice_id_, index_iter_);
-			lda::hybrid_map& row = table_[index_iter_];
-			curr_row_size_ = row.SerializedSize();
-			nonzero_entries_ += curr_row_size_ / (sizeof(int32_t)+sizeof(int32_t));
-			if (curr_row_size_ == 0) continue;
-			if (curr_row_size_ > tmp_row_buff_size_) {
-				delete[] tmp_row_buff_;
-				tmp_row_buff_size_ = curr_row_size_;
-				tmp_row_buff_ = new uint8_t[curr_row_size_];
-			}
-			curr_row_size_ = row.Serialize(tmp_row_buff_);
-			bool append_row_suc = AppendRowToBuffs(buffs,
-				tmp_row_buff_, curr_row_size_, row_id, failed_server_id);
-			if (!append_row_suc) {
-				// VLOG(0) << "Failed at row " << row_id << ". Slice id = " << slice_id_;
-				return false;
-			}
+	void DeltaSlice::SendBuff(SendBuffer& send_buffer, int32_t server_id,
+		ClientSendDeltaMsgFunc SendMsg, bool is_last, bool is_iteration_clock) {
+		petuum::RecordBuff& record_buff = send_buffer.buffs[server_id];
+		int32_t* table_end_ptr = record_buff.GetMemPtrInt32();
+		if (table_end_ptr != 0) {
+			*table_end_ptr = petuum::GlobalContext::get_serialized_table_end();
 		}
-		delete[] tmp_row_buff_;
-		return true;
+		// only the used part of the buffer goes on the wire, so there is no
+		// need to clear the rest before reusing it
+		petuum::ClientSendOpLogIterationMsg* msg = send_buffer.msgs[server_id];
+		msg->get_avai_size() = record_buff.GetMemUsedSize();
+		SendMsg(server_id, msg, is_last, is_iteration_clock);
+		++send_buffer.num_sent[server_id];
+		record_buff.ResetOffset();
+		*record_buff.GetMemPtrInt32() = petuum::GlobalContext::kWordTopicTableID;
 	}
 
-	bool DeltaSlice::AppendRowToBuffs(
-		std::unordered_map<int32_t, petuum::RecordBuff>* buffs,
-		const void* row_data, size_t row_size, int32_t row_id, int32_t& failed_server_id) {
-		int32_t server_id = petuum::GlobalContext::GetRowPartitionServerID(row_id);
-		failed_server_id = server_id;
-		return (*buffs)[server_id].Append(row_id, row_data, row_size);
+	void DeltaSlice::AppendRowsToBuffs(SendBuffer& send_buffer, int32_t begin, int32_t end,
+		ClientSendDeltaMsgFunc SendMsg) {
+		for (int32_t index = begin; index < end; ++index) {
+			lda::hybrid_map& row = table_[index];
+			size_t row_size = row.SerializedSize();
+			if (row_size == 0) continue;
+			int32_t row_id = local_vocab_->IndexToWord(slice_id_, index);
+			int32_t server_id = petuum::GlobalContext::GetRowPartitionServerID(row_id);
+			petuum::RecordBuff& record_buff = send_buffer.buffs[server_id];
+			void* row_data = record_buff.AppendReserve(row_id, row_size);
+			if (row_data == NULL) {
+				// VLOG(0) << "Not enough space for appending row, send out to " << server_id;
+				SendBuff(send_buffer, server_id, SendMsg, false, false);
+				row_data = record_buff.AppendReserve(row_id, row_size);
+				CHECK(row_data != NULL) << "Row " << row_id << " does not fit into a send msg. row size = " << row_size;
+			}
+			CHECK_EQ(row.Serialize(row_data), row_size);
+			send_buffer.nonzero_entries += row_size / (sizeof(int32_t)+sizeof(int32_t));
+		}
 	}
 
-}
\ No newline at end of file
+}
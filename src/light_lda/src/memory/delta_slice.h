@@ -2,7 +2,9 @@
 // Date: 2014.10.15
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include "memory/summary_row.hpp"
 #include "util/hybrid_map.h"
@@ -24,16 +26,28 @@ namespace lda {
 		// Must Init before called other method
 		void Init(LocalVocab* local_vocab, int32_t slice_id);
 
-		// aggregate local delta
-		void MergeFrom(const petuum::DeltaArray& delta_array);
+		// aggregate local delta. Rows touched by delta_array must only be
+		// updated by delta thread |delta_thread_id| during this slice.
+		void MergeFrom(const petuum::DeltaArray& delta_array, int32_t delta_thread_id);
+
+		// number of delta entries merged into each row since Init
+		const std::vector<int32_t>& RowLoad() const { return row_load_; }
 
 		typedef void(*ClientSendDeltaMsgFunc)(int32_t recv_id,
 			petuum::ClientSendOpLogIterationMsg* msg, bool is_last, bool is_iteration_clock);
 
-		// serialize model
-		int64_t ClientCreateSendTableDeltaMsg(
-			ClientSendDeltaMsgFunc SendMsg,
-			bool is_iteration_clock);
+		// Serializes rows of the slice and sends the full per server msgs.
+		// With delta_parallel_send every delta thread calls it and takes blocks
+		// of rows from a shared cursor, otherwise only delta thread 0 does.
+		void SerializeSendTableDelta(int32_t delta_thread_id,
+			ClientSendDeltaMsgFunc SendMsg);
+		// Called by delta thread 0 once every SerializeSendTableDelta returned:
+		// sends its remaining rows as the last msgs of the slice.
+		// num_table_msgs counts the word topic msgs the client sent to each
+		// server since start and is shared by all delta slices of the client.
+		// Returns the number of nonzero entries sent.
+		int64_t FinishSendTableDelta(ClientSendDeltaMsgFunc SendMsg,
+			bool is_iteration_clock, std::unordered_map<int32_t, int32_t>& num_table_msgs);
 
 		void GenerateRow();
 	private:
@@ -41,13 +55,29 @@ namespace lda {
 
 		void Update(int32_t word, int32_t topic, int32_t update);
 
-		// Serialize
-		bool AppendTableToBuffs(
-			std::unordered_map<int32_t, petuum::RecordBuff>* buffs,
-			int32_t& failed_server_id, bool resume);
-		bool AppendRowToBuffs(
-			std::unordered_map<int32_t, petuum::RecordBuff>* buffs,
-			const void* row_data, size_t row_size, int32_t row_id, int32_t& failed_server_id);
+		// Partitions the entries by the cache sized memory region of their row,
+		// then merges region by region.
+		void RadixMergeFrom(const petuum::DeltaArray& delta_array, int32_t delta_thread_id);
+
+		// Per delta thread serialization state
+		struct SendBuffer {
+			// server id -> reused send msg and the buffer over its data
+			std::unordered_map<int32_t, petuum::ClientSendOpLogIterationMsg*> msgs;
+			std::unordered_map<int32_t, petuum::RecordBuff> buffs;
+			// server id -> msgs sent in this slice
+			std::unordered_map<int32_t, int32_t> num_sent;
+			int64_t nonzero_entries;
+
+			SendBuffer() : nonzero_entries(0) {}
+			~SendBuffer();
+		};
+
+		// Serialize rows [begin, end) straight into the per server messages
+		void AppendRowsToBuffs(SendBuffer& send_buffer, int32_t begin, int32_t end,
+			ClientSendDeltaMsgFunc SendMsg);
+		// Closes the buffer of server_id with the table end and sends it
+		void SendBuff(SendBuffer& send_buffer, int32_t server_id,
+			ClientSendDeltaMsgFunc SendMsg, bool is_last, bool is_iteration_clock);
 	private:
 		int32_t* memory_block_;
 		int64_t memory_block_size_;
@@ -59,17 +89,37 @@ namespace lda {
 
 		int32_t num_delta_threads_;
 
-		int64_t nonzero_entries_;
+		bool radix_merge_;
+		bool record_load_;
+		std::vector<int32_t> row_load_;
+
+		struct MergeEntry {
+			int32_t index;
+			int32_t topic;
+			int32_t delta;
+		};
+		// per delta thread scratch of RadixMergeFrom
+		struct MergeScratch {
+			// entries per bucket, then where the next one goes; all zero
+			// between merges, only the touched buckets are cleared
+			std::vector<int32_t> bucket_offset;
+			std::vector<int32_t> touched;
+			std::vector<int32_t> index;
+			std::vector<int32_t> bucket;
+			std::vector<MergeEntry> entries;
+		};
+		static const int32_t kMergeBucketShift = 18; // 256KB of delta rows per bucket
+		int32_t num_merge_buckets_;
+		std::vector<MergeScratch> merge_scratch_;
 
 		// int32_t* rehashing_buf_;
 		std::vector<int32_t*> rehashing_buf_;
 		// Serialize
 		static const size_t kSendDeltaMsgSizeInit = 16 * 1024 * 1024; // 16MB
-		static const size_t kTmpRowBuffSizeInit = 64 * 1024; // 64KB
-		int32_t index_iter_; // use index_iter_ to traverse the vector
+		static const int32_t kSerializeBlockSize = 1024; // rows taken from the cursor at a time
 		size_t send_msg_data_size_;
-		size_t tmp_row_buff_size_;
-		size_t curr_row_size_;
-		uint8_t* tmp_row_buff_;
+		bool parallel_send_;
+		std::atomic<int32_t> serialize_cursor_; // next row to serialize
+		std::vector<std::unique_ptr<SendBuffer>> send_buffers_; // per delta thread
 	};
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "memory/doc_scheduler.h"
+#include <glog/logging.h>
+
+namespace lda {
+	namespace {
+		// chunks per thread, so that the last chunks to steal are small
+		const int64_t kChunksPerThread = 16;
+	}
+
+	void DocScheduler::Init(int32_t num_threads, bool work_stealing) {
+		CHECK_GT(num_threads, 0);
+		num_threads_ = num_threads;
+		work_stealing_ = work_stealing;
+		doc_tokens_.resize(num_threads);
+		threads_.reset(new ThreadChunks[num_threads]);
+		for (int32_t i = 0; i < num_threads; ++i) {
+			threads_[i].next = 0;
+			threads_[i].end = 0;
+			threads_[i].steal_from = i;
+			threads_[i].num_stolen = 0;
+		}
+	}
+
+	void DocScheduler::CountTokens(LDADataBlock& block, int32_t thread_id,
+		int32_t first_word, int32_t last_word) {
+		std::vector<int32_t>& doc_tokens = doc_tokens_[thread_id];
+		doc_tokens.clear();
+		// a document without token in the slice still costs its doc-topic
+		// counter, count it as one token
+		for (LDADocument doc : block.Docs(thread_id))
+			doc_tokens.push_back(doc.CountWords(first_word, last_word) + 1);
+	}
+
+	void DocScheduler::Schedule(LDADataBlock& block) {
+		chunk_begin_.clear();
+		if (!work_stealing_) {
+			for (int32_t i = 0; i < num_threads_; ++i) {
+				chunk_begin_.push_back(block.Begin(i));
+				threads_[i].next = i;
+				threads_[i].end = i + 1;
+				threads_[i].steal_from = i;
+				threads_[i].num_stolen = 0;
+			}
+			chunk_begin_.push_back(block.NumDocuments());
+			num_chunks_ = num_threads_;
+			return;
+		}
+
+		int64_t total_tokens = 0;
+		for (auto& doc_tokens : doc_tokens_)
+			for (int32_t tokens : doc_tokens) total_tokens += tokens;
+		int64_t chunk_tokens = (std::max)(total_tokens / (num_threads_ * kChunksPerThread), int64_t(1));
+
+		// cut the chunks, and give thread i the chunks starting in the i-th
+		// num_threads_-th of the tokens
+		std::vector<int32_t> thread_first_chunk(num_threads_ + 1, 0);
+		int64_t tokens_before = 0; // tokens before the current chunk
+		int64_t tokens = 0;
+		int32_t owner = 0;
+		int32_t doc = 0;
+		for (auto& doc_tokens : doc_tokens_) {
+			for (int32_t doc_token : doc_tokens) {
+				if (tokens == 0) {
+					int32_t chunk_owner = static_cast<int32_t>(tokens_before * num_threads_ / total_tokens);
+					while (owner < chunk_owner)
+						thread_first_chunk[++owner] = static_cast<int32_t>(chunk_begin_.size());
+					chunk_begin_.push_back(doc);
+				}
+				tokens += doc_token;
+				++doc;
+				if (tokens >= chunk_tokens) {
+					tokens_before += tokens;
+					tokens = 0;
+				}
+			}
+		}
+		CHECK_EQ(doc, block.NumDocuments());
+		num_chunks_ = static_cast<int32_t>(chunk_begin_.size());
+		while (owner < num_threads_)
+			thread_first_chunk[++owner] = num_chunks_;
+		chunk_begin_.push_back(doc);
+
+		for (int32_t i = 0; i < num_threads_; ++i) {
+			threads_[i].next = thread_first_chunk[i];
+			threads_[i].end = thread_first_chunk[i + 1];
+			threads_[i].steal_from = (i + 1) % num_threads_;
+			threads_[i].num_stolen = 0;
+		}
+	}
+
+	bool DocScheduler::NextChunk(int32_t thread_id, int32_t& doc_begin, int32_t& doc_end) {
+		ThreadChunks& self = threads_[thread_id];
+		int32_t chunk = self.next.fetch_add(1);
+		if (chunk >= self.end) {
+			if (!work_stealing_) return false;
+			// take the front chunk of the other threads in turn, an exhausted
+			// thread is not visited again in this slice
+			for (;;) {
+				if (self.steal_from == thread_id) return false;
+				ThreadChunks& victim = threads_[self.steal_from];
+				if (victim.next.load() < victim.end) {
+					chunk = victim.next.fetch_add(1);
+					if (chunk < victim.end) break;
+				}
+				self.steal_from = (self.steal_from + 1) % num_threads_;
+			}
+			++self.num_stolen;
+		}
+		doc_begin = chunk_begin_[chunk];
+		doc_end = chunk_begin_[chunk + 1];
+		return true;
+	}
+}
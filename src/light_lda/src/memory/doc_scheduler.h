@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "memory/data_block.h"
+
+namespace lda {
+	// Hands out the documents of a data block to the worker threads for one
+	// model slice. Without work stealing, thread t gets the documents
+	// [block.Begin(t), block.End(t)) as one chunk. With work stealing, the
+	// documents are cut in chunks of about the same number of tokens in the
+	// slice, each thread gets a contiguous range of chunks with the same number
+	// of tokens, and a thread done with its range takes chunks from the others.
+	//
+	// Per slice: every worker calls CountTokens (work stealing only), a barrier,
+	// one worker calls Schedule, a barrier, then every worker calls NextChunk
+	// until it returns false.
+	class DocScheduler {
+	public:
+		DocScheduler() : num_threads_(0), work_stealing_(false), num_chunks_(0) {}
+
+		void Init(int32_t num_threads, bool work_stealing);
+
+		bool WorkStealing() const { return work_stealing_; }
+
+		// Counts the tokens with words in [first_word, last_word] of the
+		// documents of block.Docs(thread_id).
+		void CountTokens(LDADataBlock& block, int32_t thread_id,
+			int32_t first_word, int32_t last_word);
+
+		void Schedule(LDADataBlock& block);
+
+		// Next documents [doc_begin, doc_end) for thread thread_id.
+		bool NextChunk(int32_t thread_id, int32_t& doc_begin, int32_t& doc_end);
+
+		// Chunks thread_id took from other threads since the last Schedule.
+		int32_t NumStolen(int32_t thread_id) const { return threads_[thread_id].num_stolen; }
+
+	private:
+		// Chunks [next, end) left to thread i. next is taken by fetch_add
+		// by the owner and by the thieves; padded to a cache line.
+		struct ThreadChunks {
+			std::atomic<int32_t> next;
+			int32_t end;
+			int32_t steal_from; // next victim, used by the owner only
+			int32_t num_stolen;
+			char padding[48];
+		};
+
+		int32_t num_threads_;
+		bool work_stealing_;
+
+		// tokens in the slice of the documents of block.Docs(i), per thread
+		std::vector<std::vector<int32_t>> doc_tokens_;
+		// chunk i is the documents [chunk_begin_[i], chunk_begin_[i + 1])
+		std::vector<int32_t> chunk_begin_;
+		int32_t num_chunks_;
+		std::unique_ptr<ThreadChunks[]> threads_;
+	};
+}
@@ -2,15 +2,16 @@
 // Data: 2014-10-11
 
 #include "memory/local_vocab.h"
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <limits>
 #include <memory>
 
 namespace lda {
-	LocalVocab::LocalVocab() : has_read_(false) {
+	LocalVocab::LocalVocab() : has_read_(false), min_word_(0) {
 		util::Context& context = util::Context::get_instance();
-		V_ = context.get_int32("num_vocabs");
 		num_threads_ = context.get_int32("num_worker_threads");
-		vocab_map_.resize(V_, -1);
 	}
 
 	LocalVocab::~LocalVocab() {
@@ -35,13 +36,122 @@ namespace lda {
 		vocab_file.read(reinterpret_cast<char*>(local_tf_), sizeof(int32_t)* vocab_size_);
 		vocab_file.close();
 
-		for (int i = 0; i < vocab_size_; ++i) {
-			vocab_map_[vocab_[i]] = i;
-		}
+		BuildWordRank();
 
 		// Compute Meta Information;
-		GenerateMetaForModelSlice();
+		bool meta_cache = util::Context::get_instance().get_bool("slice_meta_cache");
+		std::string meta_file_name = file_name + ".meta";
+		MetaKey key = ComputeMetaKey();
+		if (!meta_cache || !LoadMeta(meta_file_name, key)) {
+			GenerateMetaForModelSlice();
+			if (meta_cache) SaveMeta(meta_file_name, key);
+		}
 		has_read_ = true;
+
+		int64_t meta_size = static_cast<int64_t>(vocab_size_) * sizeof(WordEntry);
+		int64_t rank_size = static_cast<int64_t>(word_rank_.size()) * sizeof(RankBlock);
+		LOG(INFO) << "Local vocab " << file_name << ": " << vocab_size_ << " words, "
+			<< MemorySize() / 1024
+			<< " KB (word map " << rank_size / 1024 << " KB, meta " << meta_size / 1024 << " KB)";
+	}
+
+	LocalVocab::MetaKey LocalVocab::ComputeMetaKey() const {
+		util::Context& context = util::Context::get_instance();
+		MetaKey key;
+		key.version = 1;
+		key.entry_size = sizeof(WordEntry);
+		key.num_topics = context.get_int32("num_topics");
+		key.load_factor = context.get_int32("load_factor");
+		key.model_max_capacity = context.get_int64("model_max_capacity");
+		key.alias_max_capacity = context.get_int64("alias_max_capacity");
+		key.delta_max_capacity = context.get_int64("delta_max_capacity");
+		// FNV-1a over the words of the vocab file
+		uint64_t checksum = 14695981039346656037ULL;
+		auto add = [&checksum](const int32_t* values, int32_t size) {
+			for (int32_t i = 0; i < size; ++i)
+				checksum = (checksum ^ static_cast<uint32_t>(values[i])) * 1099511628211ULL;
+		};
+		add(&vocab_size_, 1);
+		add(vocab_, vocab_size_);
+		add(tf_, vocab_size_);
+		add(local_tf_, vocab_size_);
+		key.vocab_checksum = checksum;
+		return key;
+	}
+
+	// Meta file: the MetaKey, the number of slices (int32), slice_index_
+	// (int32 * (num_slices + 1)), then the WordEntry of every word.
+	bool LocalVocab::LoadMeta(const std::string& meta_file_name, const MetaKey& key) {
+		std::ifstream meta_file(meta_file_name, std::ios::in | std::ios::binary);
+		if (!meta_file.good()) return false;
+		MetaKey file_key;
+		meta_file.read(reinterpret_cast<char*>(&file_key), sizeof(MetaKey));
+		if (!meta_file.good() || memcmp(&file_key, &key, sizeof(MetaKey)) != 0) {
+			LOG(INFO) << "Slice meta " << meta_file_name << " is out of date";
+			return false;
+		}
+		int32_t num_of_slice = -1;
+		meta_file.read(reinterpret_cast<char*>(&num_of_slice), sizeof(int32_t));
+		if (!meta_file.good() || num_of_slice < 0 || num_of_slice > vocab_size_) {
+			LOG(WARNING) << "Slice meta " << meta_file_name << " is corrupted";
+			return false;
+		}
+		std::vector<int32_t> slice_index(num_of_slice + 1);
+		meta_file.read(reinterpret_cast<char*>(slice_index.data()), sizeof(int32_t)* (num_of_slice + 1));
+		bool valid = meta_file.good() && slice_index.front() == 0 && slice_index.back() == vocab_size_;
+		for (int32_t i = 0; valid && i < num_of_slice; ++i)
+			valid = slice_index[i] < slice_index[i + 1];
+		if (!valid) {
+			LOG(WARNING) << "Slice meta " << meta_file_name << " is corrupted";
+			return false;
+		}
+		std::vector<SliceMeta> slice_meta(num_of_slice);
+		for (int32_t i = 0; i < num_of_slice; ++i) {
+			slice_meta[i].resize(slice_index[i + 1] - slice_index[i]);
+			meta_file.read(reinterpret_cast<char*>(slice_meta[i].data()), sizeof(WordEntry)* slice_meta[i].size());
+		}
+		if (!meta_file.good()) {
+			LOG(WARNING) << "Slice meta " << meta_file_name << " is corrupted";
+			return false;
+		}
+		slice_index_.swap(slice_index);
+		slice_meta_.swap(slice_meta);
+		num_of_slice_ = num_of_slice;
+		return true;
+	}
+
+	void LocalVocab::SaveMeta(const std::string& meta_file_name, const MetaKey& key) const {
+		// written aside and renamed, so that a meta file is complete
+		std::string tmp_file_name = meta_file_name + ".tmp";
+		std::ofstream meta_file(tmp_file_name, std::ios::out | std::ios::binary);
+		meta_file.write(reinterpret_cast<const char*>(&key), sizeof(MetaKey));
+		meta_file.write(reinterpret_cast<const char*>(&num_of_slice_), sizeof(int32_t));
+		meta_file.write(reinterpret_cast<const char*>(slice_index_.data()), sizeof(int32_t)* slice_index_.size());
+		for (const SliceMeta& slice_meta : slice_meta_)
+			meta_file.write(reinterpret_cast<const char*>(slice_meta.data()), sizeof(WordEntry)* slice_meta.size());
+		meta_file.close();
+		if (!meta_file.good() || std::rename(tmp_file_name.c_str(), meta_file_name.c_str()) != 0) {
+			LOG(WARNING) << "Fails to save slice meta " << meta_file_name;
+			std::remove(tmp_file_name.c_str());
+		}
+	}
+
+	void LocalVocab::BuildWordRank() {
+		word_rank_.clear();
+		if (vocab_size_ == 0) return;
+		min_word_ = vocab_[0];
+		int64_t range = static_cast<int64_t>(vocab_[vocab_size_ - 1]) - min_word_ + 1;
+		word_rank_.resize((range + 63) / 64, RankBlock{ 0, 0 });
+		for (int32_t i = 0; i < vocab_size_; ++i) {
+			CHECK(i == 0 || vocab_[i] > vocab_[i - 1]) << "The word ids of a local vocab must be sorted";
+			int32_t offset = vocab_[i] - min_word_;
+			word_rank_[offset >> 6].bits |= uint64_t(1) << (offset & 63);
+		}
+		int32_t rank = 0;
+		for (RankBlock& block : word_rank_) {
+			block.rank = rank;
+			rank += PopCount(block.bits);
+		}
 	}
 
 	void LocalVocab::SerializeAs(void* bytes, int32_t size, int32_t slice_id) const {
@@ -61,6 +171,13 @@ namespace lda {
 		int64_t model_max_capacity = context.get_int64("model_max_capacity");
 		int64_t alias_max_capacity = context.get_int64("alias_max_capacity");
 		int64_t delta_max_capacity = context.get_int64("delta_max_capacity");
+		// 0 bounds the slice tables only by the 2^32 elements the offsets address
+		const int64_t kMaxSliceCapacity = std::numeric_limits<uint32_t>::max();
+		if (model_max_capacity == 0) model_max_capacity = kMaxSliceCapacity;
+		if (alias_max_capacity == 0) alias_max_capacity = kMaxSliceCapacity;
+		if (delta_max_capacity == 0) delta_max_capacity = kMaxSliceCapacity;
+		CHECK_LE((std::max)(model_max_capacity, (std::max)(alias_max_capacity, delta_max_capacity)),
+			int64_t(std::numeric_limits<uint32_t>::max())) << "Slice tables are limited to 2^32 elements";
 
 		int32_t model_hot_thresh = num_topics / (2 * load_factor); 
 		int32_t alias_hot_thresh = (num_topics * 2) / 3; 
@@ -80,52 +197,49 @@ namespace lda {
 
 			int32_t capacity, table_size;
 			if (tf >= model_hot_thresh) {
-				word_entry.is_model_dense_ = 1;
+				word_entry.is_model_dense_ = true;
 				capacity = num_topics;
 				table_size = capacity;
 			}
 			else {
-				word_entry.is_model_dense_ = 0;
+				word_entry.is_model_dense_ = false;
 				int32_t capacity_lower_bound = load_factor * tf;
 				capacity = upper_bound(capacity_lower_bound);
 				table_size = capacity * 2;
 			}
-			word_entry.offset_ = model_offset;
-			word_entry.end_offset_ = model_offset + table_size;
+			word_entry.offset_ = static_cast<uint32_t>(model_offset);
 			word_entry.capacity_ = capacity;
 			model_offset += table_size;
 
 			int32_t alias_capacity, alias_buf_size;
 			if (tf >= alias_hot_thresh) {
-				word_entry.is_alias_dense_ = 1;
+				word_entry.is_alias_dense_ = true;
 				alias_buf_size = 2 * num_topics;
 				alias_capacity = num_topics;
 			}
 			else {
-				word_entry.is_alias_dense_ = 0;
+				word_entry.is_alias_dense_ = false;
 				alias_buf_size = 3 * tf;
 				alias_capacity = tf;
 			}
 			word_entry.alias_capacity_ = alias_capacity;
-			word_entry.alias_offset_ = alias_offset;
-			word_entry.alias_end_offset_ = alias_offset + alias_buf_size;
+			word_entry.alias_offset_ = static_cast<uint32_t>(alias_offset);
 			alias_offset += alias_buf_size;
 
 			int32_t delta_capacity, delta_buf_size;
 			if (local_tf >= delta_hot_thresh) {
-				word_entry.is_delta_dense_ = 1;
+				word_entry.is_delta_dense_ = true;
 				delta_buf_size = num_topics;
 				delta_capacity = num_topics;
 			}
 			else {
-				word_entry.is_delta_dense_ = 0;
+				word_entry.is_delta_dense_ = false;
 				int32_t capacity_lower_bound = load_factor * 2 * local_tf;
 				delta_capacity = upper_bound(capacity_lower_bound);
 				delta_buf_size = 2 * delta_capacity;
 			}
 			word_entry.delta_capacity_ = delta_capacity;
-			word_entry.delta_offset_ = delta_offset;
-			word_entry.delta_end_offset_ = delta_offset + delta_buf_size;
+			word_entry.delta_offset_ = static_cast<uint32_t>(delta_offset);
 			delta_offset += delta_buf_size;
 
 			if (model_offset > model_max_capacity || 
@@ -136,19 +250,13 @@ namespace lda {
 				slice_index_.push_back(i);
 				slice_meta.reset(new SliceMeta);
 
-				model_offset = 0; alias_offset = 0; delta_offset = 0;
-
-				word_entry.offset_ = model_offset;
-				word_entry.end_offset_ = model_offset + table_size;
-				model_offset += table_size;
-
-				word_entry.alias_offset_ = alias_offset;
-				word_entry.alias_end_offset_ = alias_offset + alias_buf_size;
-				alias_offset += alias_buf_size;
-
-				word_entry.delta_offset_ = delta_offset;
-				word_entry.delta_end_offset_ = delta_offset + delta_buf_size;
-				delta_offset += delta_buf_size;
+				// the word starts the new slice
+				word_entry.offset_ = 0;
+				word_entry.alias_offset_ = 0;
+				word_entry.delta_offset_ = 0;
+				model_offset = table_size;
+				alias_offset = alias_buf_size;
+				delta_offset = delta_buf_size;
 			}
 			
 			slice_meta->push_back(word_entry);
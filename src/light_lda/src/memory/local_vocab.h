@@ -7,25 +7,25 @@
 #include <cstdint>
 #include <numeric>
 #include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "lda/context.hpp"
 
 namespace lda {
 
+	// Offsets are in int32 elements from the start of the slice tables,
+	// which model/alias/delta_max_capacity keep below 2^32.
 	struct WordEntry {
-		int32_t is_model_dense_;
-		int64_t offset_;
-		int64_t end_offset_;
+		uint32_t offset_;
+		uint32_t alias_offset_;
+		uint32_t delta_offset_;
 		int32_t capacity_; // global_tf
-		
-		int32_t is_alias_dense_;
-		int64_t alias_offset_;
-		int64_t alias_end_offset_;
 		int32_t alias_capacity_; // num_non_zero
-
-		int32_t is_delta_dense_;
-		int64_t delta_offset_;
-		int64_t delta_end_offset_;
 		int32_t delta_capacity_; // 2 * local_tf
+		bool is_model_dense_;
+		bool is_alias_dense_;
+		bool is_delta_dense_;
 	};
 
 	// Meta information for one slice
@@ -37,7 +37,10 @@ namespace lda {
 		LocalVocab();
 		~LocalVocab();
 
-		// All method should be called after Read
+		// All method should be called after Read. With slice_meta_cache, the
+		// slice meta is loaded from file_name + ".meta" if it was saved for
+		// the same vocab and model settings, else generated and saved there.
+		// Blocks may be read by different threads.
 		void Read(const std::string& file_name);
 
 		int32_t NumOfSlice() const;
@@ -52,6 +55,11 @@ namespace lda {
 		int32_t FirstWord(int32_t slice_id) const;
 		
 		int32_t SliceSize(int32_t slice_id) const;
+		// int32 elements the model, alias and delta tables of the slice take
+		void SliceTableSize(int32_t slice_id, int64_t* model_size,
+			int64_t* alias_size, int64_t* delta_size) const;
+		// Bytes held by the vocab and its slice meta
+		int64_t MemorySize() const;
 		SliceMeta& Meta(int32_t slice_id);
 		// get WordID based on the index of Model/Delta/Alias Table.
 		int32_t IndexToWord(int32_t slice_id, int32_t index) const;
@@ -62,26 +70,61 @@ namespace lda {
 		int64_t GlobalTFSum(int32_t slice_id) {
 			return std::accumulate(tf_ + slice_index_[slice_id], tf_ + slice_index_[slice_id+1], int64_t(0));
 		}
+		int32_t LocalTF(int32_t slice_id, int32_t index) const {
+			return local_tf_[slice_index_[slice_id] + index];
+		}
 		int64_t LocalTFSum(int32_t slice_id) {
 			return std::accumulate(local_tf_ + slice_index_[slice_id], local_tf_ + slice_index_[slice_id+1], int64_t(0));
 		}
 	private:
+		// What the slice meta is computed from
+		struct MetaKey {
+			int64_t version; // of the meta file format
+			int64_t entry_size;
+			int64_t num_topics;
+			int64_t load_factor;
+			int64_t model_max_capacity;
+			int64_t alias_max_capacity;
+			int64_t delta_max_capacity;
+			uint64_t vocab_checksum; // of the word ids, tf and local tf
+		};
+
 		void GenerateMetaForModelSlice();
+		MetaKey ComputeMetaKey() const;
+		bool LoadMeta(const std::string& meta_file_name, const MetaKey& key);
+		void SaveMeta(const std::string& meta_file_name, const MetaKey& key) const;
+		void BuildWordRank();
 		int32_t upper_bound(int32_t x);
 
+		static int32_t PopCount(uint64_t bits) {
+#ifdef _MSC_VER
+			return static_cast<int32_t>(__popcnt64(bits));
+#else
+			return __builtin_popcountll(bits);
+#endif
+		}
+
+		// 64 word ids from min_word_ + 64 * i: a bit per word of the vocab,
+		// and the number of vocab words before them
+		struct RankBlock {
+			uint64_t bits;
+			int32_t rank;
+		};
+
 	private:
 		bool has_read_;
 		int32_t* vocab_;
 		int32_t* tf_;
 		int32_t* local_tf_;
 		int32_t vocab_size_;
-		std::vector<int32_t> vocab_map_;
+		// word -> index of vocab_, by rank over the range of the word ids
+		int32_t min_word_;
+		std::vector<RankBlock> word_rank_;
 
 		std::vector<int32_t> slice_index_;
 		std::vector<SliceMeta> slice_meta_;
 		int32_t num_of_slice_;
 
-		int32_t V_;
 		int32_t num_threads_;
 	};
 
@@ -115,6 +158,23 @@ namespace lda {
 		return slice_index_[slice_id + 1] - slice_index_[slice_id];
 	}
 
+	inline void LocalVocab::SliceTableSize(int32_t slice_id, int64_t* model_size,
+		int64_t* alias_size, int64_t* delta_size) const {
+		*model_size = *alias_size = *delta_size = 0;
+		if (slice_meta_[slice_id].empty()) return;
+		// the tables of a slice end with the rows of its last word
+		const WordEntry& last = slice_meta_[slice_id].back();
+		*model_size = last.offset_ + static_cast<int64_t>(last.is_model_dense_ ? 1 : 2) * last.capacity_;
+		*alias_size = last.alias_offset_ + static_cast<int64_t>(last.is_alias_dense_ ? 2 : 3) * last.alias_capacity_;
+		*delta_size = last.delta_offset_ + static_cast<int64_t>(last.is_delta_dense_ ? 1 : 2) * last.delta_capacity_;
+	}
+
+	inline int64_t LocalVocab::MemorySize() const {
+		return 3 * sizeof(int32_t) * static_cast<int64_t>(vocab_size_) +
+			sizeof(WordEntry) * static_cast<int64_t>(vocab_size_) +
+			sizeof(RankBlock) * static_cast<int64_t>(word_rank_.size());
+	}
+
 	inline int32_t LocalVocab::IndexToWord(int32_t slice_id, int32_t index) const {
 		int32_t index_of_vocab = slice_index_[slice_id] + index;
 		CHECK(index_of_vocab < vocab_size_) 
@@ -123,9 +183,12 @@ namespace lda {
 	}
 
 	inline int32_t LocalVocab::WordToIndex(int32_t slice_id, int32_t word) const {
-		if (vocab_map_[word] == -1) return -1;
-		CHECK_NE(vocab_map_[word], -1);
-		return vocab_map_[word] - slice_index_[slice_id];
+		uint32_t offset = static_cast<uint32_t>(word - min_word_);
+		if (offset >= word_rank_.size() * 64) return -1;
+		const RankBlock& block = word_rank_[offset >> 6];
+		uint64_t bit = uint64_t(1) << (offset & 63);
+		if ((block.bits & bit) == 0) return -1;
+		return block.rank + PopCount(block.bits & (bit - 1)) - slice_index_[slice_id];
 	}
 
 	inline int32_t LocalVocab::upper_bound(int32_t x) {
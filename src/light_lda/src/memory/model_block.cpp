@@ -18,7 +18,7 @@ namespace petuum{
 		lock_(kLockPoolSize)
 	{
 		send_msg_data_size_ = kSendDeltaMsgSizeInit;
-		tmp_row_buff_size_ = kTmpRowBuffSizeInit;
+		send_msg_ = nullptr;
 		int32_t num_topics = petuum::GlobalContext::get_num_topics();
 		rehashing_buf_ = new int32_t[2 * num_topics];
 	}
@@ -37,6 +37,7 @@ namespace petuum{
 			delete[]num_deleted_key_vector_;
 		}*/
 		delete[] rehashing_buf_;
+		delete send_msg_;
 	}
 	void LDAModelBlock::Read(const std::string &meta_name)
 	{
@@ -119,8 +120,10 @@ namespace petuum{
 		ClientModelSliceRequestMsg& slice_request_msg,
 		ServerPushModelSliceMsgFunc SendMsg) {
 
-		petuum::ServerPushOpLogIterationMsg* msg =
-			new petuum::ServerPushOpLogIterationMsg(send_msg_data_size_);
+		// the message is reused across requests, comm bus copies it on send
+		if (send_msg_ == nullptr)
+			send_msg_ = new petuum::ServerPushOpLogIterationMsg(send_msg_data_size_);
+		petuum::ServerPushOpLogIterationMsg* msg = send_msg_;
 		petuum::RecordBuff record_buff(msg->get_data(), send_msg_data_size_);
 
 		int32_t head_bg_id = petuum::GlobalContext::get_head_bg_id(client_id);
@@ -129,9 +132,7 @@ namespace petuum{
 		int32_t *table_id_ptr = record_buff.GetMemPtrInt32();
 		if (table_id_ptr == 0) {
 			//VLOG(0) << "Not enough space for table id, send out to " << head_bg_id;
-			SendMsg(head_bg_id, msg, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, head_bg_id, record_buff, false);
 			table_id_ptr = record_buff.GetMemPtrInt32();
 		}
 		*table_id_ptr = GlobalContext::kWordTopicTableID;
@@ -141,47 +142,37 @@ namespace petuum{
 		words++;
 		CHECK_EQ((num_words + 1) * sizeof(int32_t), slice_request_msg.get_avai_size()) << "num of requested word = " << num_words;
 		int32_t request_word_index = 0;
-		InitAppendTableToBuffs();
 
-		bool pack_suc = AppendTableToBuffs(client_id, words, num_words, request_word_index, &record_buff, false);
+		bool pack_suc = AppendTableToBuffs(client_id, words, num_words, request_word_index, &record_buff);
 		while (!pack_suc) {
 			int32_t* buff_end_ptr = record_buff.GetMemPtrInt32();
 			if (buff_end_ptr != 0)
 				*buff_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			SendMsg(head_bg_id, msg, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, head_bg_id, record_buff, false);
 			int32_t* table_id_ptr = record_buff.GetMemPtrInt32();
 			*table_id_ptr = GlobalContext::kWordTopicTableID;
-			pack_suc = AppendTableToBuffs(client_id, words, num_words, request_word_index, &record_buff, true);
+			// the failed row is serialized again into the emptied buffer
+			pack_suc = AppendTableToBuffs(client_id, words, num_words, request_word_index, &record_buff);
 		}
 
 		int32_t* table_end_ptr = record_buff.GetMemPtrInt32();
-		if (table_end_ptr == 0) {
-			SendMsg(head_bg_id, msg, true);
-		}
-		else {
+		if (table_end_ptr != 0) {
 			*table_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			msg->get_avai_size() = record_buff.GetMemUsedSize();
-			SendMsg(head_bg_id, msg, true);
 		}
-		delete msg;
+		SendBuff(SendMsg, head_bg_id, record_buff, true);
 	}
 
-	void LDAModelBlock::InitAppendTableToBuffs() {
-		index_iter_ = 0;
-		tmp_row_buff_ = new uint8_t[tmp_row_buff_size_];
+	void LDAModelBlock::SendBuff(ServerPushModelSliceMsgFunc SendMsg, int32_t bg_id,
+		petuum::RecordBuff& record_buff, bool is_last) {
+		// only the used part of the buffer is sent, no need to clear it
+		send_msg_->get_avai_size() = record_buff.GetMemUsedSize();
+		SendMsg(bg_id, send_msg_, is_last);
+		record_buff.ResetOffset();
 	}
 
 	bool LDAModelBlock::AppendTableToBuffs(int32_t client_id,
 		int32_t* words, int32_t num_word, int32_t& word_index,
-		petuum::RecordBuff* buffs, bool resume) {
-		if (resume) {
-			int32_t row_id = words[word_index];
-			bool append_row_suc = AppendRowToBuffs(client_id, buffs, tmp_row_buff_, curr_row_size_, row_id);
-			if (!append_row_suc) return false;
-			++word_index;
-		}
+		petuum::RecordBuff* buffs) {
 		for (; word_index != num_word; ++word_index) {
 			int32_t row_id = words[word_index];
 			// judge if requested word in current Server ModelBlock
@@ -191,32 +182,16 @@ namespace petuum{
 			Unlocker<> unlock;
 			lock_.Lock(row_id, &unlock);
 			hybrid_map& row = get_row(row_id);
-			curr_row_size_ = row.SerializedSize();//SerializedSize();
-			if (curr_row_size_ == 0) continue;
-			if (curr_row_size_ > tmp_row_buff_size_) {
-				delete[] tmp_row_buff_;
-				tmp_row_buff_size_ = curr_row_size_;
-				tmp_row_buff_ = new uint8_t[curr_row_size_];
-			}
-			curr_row_size_ = row.Serialize(tmp_row_buff_);//->Serialize(tmp_row_buff_);
-			bool append_row_suc = AppendRowToBuffs(client_id, buffs, tmp_row_buff_, curr_row_size_, row_id);
-			if (!append_row_suc) {
-				//VLOG(0) << "Failed at row " << index_iter_;
+			size_t row_size = row.SerializedSize();
+			if (row_size == 0) continue;
+			void* row_data = buffs->AppendReserve(row_id, row_size);
+			if (row_data == NULL) {
+				//VLOG(0) << "Failed at row " << row_id;
 				return false;
 			}
+			CHECK_EQ(row.Serialize(row_data), row_size);
 		}
-		delete[] tmp_row_buff_;
 		return true;
 	}
 
-	bool LDAModelBlock::AppendRowToBuffs(int32_t client_id,
-		petuum::RecordBuff* buffs,
-		const void* row_data, size_t row_size, int32_t row_id) {
-		int32_t bg_id = petuum::GlobalContext::get_head_bg_id(client_id);
-		bool suc = buffs->Append(row_id, row_data, row_size);
-		//if (!suc)
-		//VLOG(0) << "Append Row to Buffs failed at row " << row_id;
-		return suc;
-	}
-
 }
\ No newline at end of file
@@ -71,12 +71,11 @@ namespace petuum {
 			// return client_id_ * GlobalContext::get_num_clients() + index;
 			return index * GlobalContext::get_num_clients() + client_id_;
 		}
-		void InitAppendTableToBuffs();
+		// serializes the requested rows straight into the send message
 		bool AppendTableToBuffs(int32_t client_id, int32_t* words, int32_t num_word, int32_t& word_index,
-			petuum::RecordBuff* buffs, bool resume);
-		bool AppendRowToBuffs(int32_t client_id,
-			petuum::RecordBuff* buffs,
-			const void* row_data, size_t row_size, int32_t row_id);
+			petuum::RecordBuff* buffs);
+		void SendBuff(ServerPushModelSliceMsgFunc SendMsg, int32_t bg_id,
+			petuum::RecordBuff& record_buff, bool is_last);
 
 		LDAModelBlock(const LDAModelBlock &other) = delete;
 		LDAModelBlock& operator=(const LDAModelBlock &other) = delete;
@@ -98,12 +97,8 @@ namespace petuum {
 
 		// for serialization
 		static const size_t kSendDeltaMsgSizeInit = 16 * 1024 * 1024;
-		static const size_t kTmpRowBuffSizeInit = 64 * 1024;
-		int32_t index_iter_; // use index_iter_ to traverse the vector
 		size_t send_msg_data_size_;
-		size_t tmp_row_buff_size_;
-		size_t curr_row_size_;
-		uint8_t* tmp_row_buff_;
+		petuum::ServerPushOpLogIterationMsg* send_msg_; // reused across requests
 	};
 
 }
\ No newline at end of file
@@ -8,7 +8,8 @@
 namespace lda {
 	ModelSlice::ModelSlice() {
 		util::Context& context = util::Context::get_instance();
-		memory_block_size_ = context.get_int64("model_max_capacity");
+		// sized to the largest slice by the memory plan of LDAEngine
+		memory_block_size_ = context.get_int64("model_slice_size");
 		try {
 			memory_block_ = new int32_t[memory_block_size_];
 		}
@@ -17,8 +18,7 @@ namespace lda {
 			LOG(FATAL) << "Bad Alloc caught: " << ba.what();
 		}
 
-		int32_t V = context.get_int32("num_vocabs");
-		table_.resize(V);
+		table_.resize(context.get_int32("slice_num_words"));
 		int32_t K = context.get_int32("num_topics");
 		rehashing_buf_ = new int32_t[K];
 	}
@@ -34,6 +34,8 @@ namespace lda {
 		int32_t SliceId() const;
 		LocalVocab* GetLocalVocab() const;
 		int32_t LastWord() const;
+		// The slice is the only one of its block and holds all its words
+		bool SingleSlice() const;
 
 		void GenerateRow();
 
@@ -73,6 +75,10 @@ namespace lda {
 		return local_vocab_->LastWord(slice_id_);
 	}
 
+	inline bool ModelSlice::SingleSlice() const {
+		return local_vocab_->NumOfSlice() == 1;
+	}
+
 	inline lda::hybrid_map& ModelSlice::GetRow(int32_t word) {
 		int32_t index = local_vocab_->WordToIndex(slice_id_, word);
 		CHECK(index >= 0 && index < local_vocab_->SliceSize(slice_id_));
@@ -37,16 +37,17 @@ namespace petuum {
 		summary_row_.ApplySparseBatchIncUnsafe(data, row_size);
 	}
 
-	void ClientSummaryRow::InitAppendTableToBuffs() {
-		tmp_row_buff_ = new uint8_t[tmp_row_buff_size_];
+	ClientSummaryRow::~ClientSummaryRow() {
+		delete send_msg_;
 	}
 
 	void ClientSummaryRow::ClientCreateSendTableDeltaMsg(
 		ClientSendTableDeltaMsgFunc SendMsg) {
 
-		/*petuum::ServerPushOpLogIterationMsg* msg =
-			new petuum::ServerPushOpLogIterationMsg(send_msg_data_size_);*/
-		petuum::ClientSendOpLogIterationMsg* msg = new petuum::ClientSendOpLogIterationMsg(send_msg_data_size_);
+		// the message is reused across clocks, comm bus copies it on send
+		if (send_msg_ == nullptr)
+			send_msg_ = new petuum::ClientSendOpLogIterationMsg(send_msg_data_size_);
+		petuum::ClientSendOpLogIterationMsg* msg = send_msg_;
 		petuum::RecordBuff record_buff(msg->get_data(), send_msg_data_size_);
 
 		VLOG(0) << "Client Create send summary row delta msg " << table_id_;
@@ -56,74 +57,48 @@ namespace petuum {
 		int32_t *table_id_ptr = record_buff.GetMemPtrInt32();
 		if (table_id_ptr == 0) {
 			VLOG(0) << "Not enough space for table id, send out to " << server_id;
-			SendMsg(server_id, msg, false, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, server_id, record_buff, false);
 			table_id_ptr = record_buff.GetMemPtrInt32();
 		}
 		*table_id_ptr = table_id_;
-		InitAppendTableToBuffs();
-		bool pack_suc = AppendTableToBuffs(&record_buff, false);
+		bool pack_suc = AppendTableToBuffs(&record_buff);
 		while (!pack_suc) {
 			int32_t* buff_end_ptr = record_buff.GetMemPtrInt32();
 			if (buff_end_ptr != 0)
 				*buff_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			SendMsg(server_id, msg, false, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, server_id, record_buff, false);
 			int32_t* table_id_ptr = record_buff.GetMemPtrInt32();
 			*table_id_ptr = table_id_;
-			pack_suc = AppendTableToBuffs(&record_buff, true);
+			pack_suc = AppendTableToBuffs(&record_buff);
 		}
 
 		int32_t* table_end_ptr = record_buff.GetMemPtrInt32();
-		if (table_end_ptr == 0) {
-			SendMsg(server_id, msg, true, false);
-		}
-		else {
+		if (table_end_ptr != 0) {
 			*table_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			msg->get_avai_size() = record_buff.GetMemUsedSize();
-			SendMsg(server_id, msg, true, false);
 		}
-		delete msg;
+		SendBuff(SendMsg, server_id, record_buff, true);
 	}
 
+	void ClientSummaryRow::SendBuff(ClientSendTableDeltaMsgFunc SendMsg, int32_t server_id,
+		petuum::RecordBuff& record_buff, bool is_last) {
+		// only the used part of the buffer is sent, no need to clear it
+		send_msg_->get_avai_size() = record_buff.GetMemUsedSize();
+		SendMsg(server_id, send_msg_, is_last, false);
+		record_buff.ResetOffset();
+	}
 
-	bool ClientSummaryRow::AppendTableToBuffs(
-		petuum::RecordBuff* buffs, bool resume) {
-		if (resume) {
-			bool append_row_suc = AppendRowToBuffs(buffs, tmp_row_buff_, curr_row_size_, 0);
-			if (!append_row_suc) return false;
-			//++index_iter_;
-		}
-		//for (; index_iter_ != num_words_; ++index_iter_) {
-		curr_row_size_ = summary_row_.SparseSerializedSize();//SerializedSize();
-		if (curr_row_size_ > tmp_row_buff_size_) {
-			delete[] tmp_row_buff_;
-			tmp_row_buff_size_ = curr_row_size_;
-			tmp_row_buff_ = new uint8_t[curr_row_size_];
-		}
-		VLOG(0) << "Serialize summary row " << " row size = " << curr_row_size_;
-		curr_row_size_ = summary_row_.SparseSerialize(tmp_row_buff_);//->Serialize(tmp_row_buff_);
-		VLOG(0) << "Sucecss serialize summary row " << " row size = " << curr_row_size_;
-		bool append_row_suc = AppendRowToBuffs(buffs, tmp_row_buff_, curr_row_size_, 0);
-		if (!append_row_suc) {
+	bool ClientSummaryRow::AppendTableToBuffs(petuum::RecordBuff* buffs) {
+		size_t row_size = summary_row_.SparseSerializedSize();
+		VLOG(0) << "Serialize summary row " << " row size = " << row_size;
+		void* row_data = buffs->AppendReserve(0, row_size);
+		if (row_data == NULL) {
 			VLOG(0) << "Failed at Summary Row";
 			return false;
 		}
-		//}
-		delete[] tmp_row_buff_;
+		CHECK_EQ(summary_row_.SparseSerialize(row_data), row_size);
 		return true;
 	}
 
-	bool ClientSummaryRow::AppendRowToBuffs(
-		petuum::RecordBuff* buffs,
-		const void* row_data, size_t row_size, int32_t row_id) {
-		//int32_t bg_id = petuum::GlobalContext::get_head_bg_id(client_id);
-		bool suc = buffs->Append(row_id, row_data, row_size);
-		return suc;
-	}
-
 	void ClientSummaryRow::MergeFrom(const DeltaArray& other) {
 		for (int i = 0; i < other.index_; ++i) {
 			//CHECK_LE(summary_row_[other.array_[i].topic_id], 0x7FFFFFFFFFFFFFFE);
@@ -174,10 +149,16 @@ namespace petuum {
 		summary_row_.ApplySparseBatchIncUnsafe(data, row_size);
 	}
 
+	ServerSummaryRow::~ServerSummaryRow() {
+		delete send_msg_;
+	}
+
 	void ServerSummaryRow::ServerCreateSendModelSliceMsg(int32_t client_id,
 		ServerPushModelSliceMsgFunc SendMsg) {
-		petuum::ServerPushOpLogIterationMsg* msg =
-			new petuum::ServerPushOpLogIterationMsg(send_msg_data_size_);
+		// the message is reused across requests, comm bus copies it on send
+		if (send_msg_ == nullptr)
+			send_msg_ = new petuum::ServerPushOpLogIterationMsg(send_msg_data_size_);
+		petuum::ServerPushOpLogIterationMsg* msg = send_msg_;
 		petuum::RecordBuff record_buff(msg->get_data(), send_msg_data_size_);
 
 		VLOG(0) << "Server Serializing table " << table_id_;
@@ -187,76 +168,47 @@ namespace petuum {
 		int32_t *table_id_ptr = record_buff.GetMemPtrInt32();
 		if (table_id_ptr == 0) {
 			VLOG(0) << "Not enough space for table id, send out to " << head_bg_id;
-			SendMsg(head_bg_id, msg, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, head_bg_id, record_buff, false);
 			table_id_ptr = record_buff.GetMemPtrInt32();
 		}
 		CHECK_EQ(table_id_, GlobalContext::kSummaryRowID);
 		*table_id_ptr = table_id_;
-		InitAppendTableToBuffs();
-		bool pack_suc = AppendTableToBuffs(client_id, &record_buff, false);
+		bool pack_suc = AppendTableToBuffs(&record_buff);
 		while (!pack_suc) {
 			int32_t* buff_end_ptr = record_buff.GetMemPtrInt32();
 			if (buff_end_ptr != 0)
 				*buff_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			SendMsg(head_bg_id, msg, false);
-			memset(msg->get_data(), 0, send_msg_data_size_);
-			record_buff.ResetOffset();
+			SendBuff(SendMsg, head_bg_id, record_buff, false);
 			int32_t* table_id_ptr = record_buff.GetMemPtrInt32();
 			*table_id_ptr = table_id_;
-			pack_suc = AppendTableToBuffs(client_id, &record_buff, true);
+			pack_suc = AppendTableToBuffs(&record_buff);
 		}
 
 		int32_t* table_end_ptr = record_buff.GetMemPtrInt32();
-		if (table_end_ptr == 0) {
-			SendMsg(head_bg_id, msg, true);
-		}
-		else {
+		if (table_end_ptr != 0) {
 			*table_end_ptr = petuum::GlobalContext::get_serialized_table_end();
-			msg->get_avai_size() = record_buff.GetMemUsedSize();
-			SendMsg(head_bg_id, msg, true);
 		}
-		delete msg;
+		SendBuff(SendMsg, head_bg_id, record_buff, true);
 	}
 
-
-	void ServerSummaryRow::InitAppendTableToBuffs() {
-		tmp_row_buff_ = new uint8_t[tmp_row_buff_size_];
+	void ServerSummaryRow::SendBuff(ServerPushModelSliceMsgFunc SendMsg, int32_t bg_id,
+		petuum::RecordBuff& record_buff, bool is_last) {
+		// only the used part of the buffer is sent, no need to clear it
+		send_msg_->get_avai_size() = record_buff.GetMemUsedSize();
+		SendMsg(bg_id, send_msg_, is_last);
+		record_buff.ResetOffset();
 	}
 
-	bool ServerSummaryRow::AppendTableToBuffs(int32_t client_id, 
-		petuum::RecordBuff* buffs, bool resume) {
+	bool ServerSummaryRow::AppendTableToBuffs(petuum::RecordBuff* buffs) {
 		std::lock_guard<std::mutex> lock_guard(mutex_);
-		if (resume) {
-			bool append_row_suc = AppendRowToBuffs(client_id, buffs, tmp_row_buff_, curr_row_size_, 0);
-			if (!append_row_suc) return false;
-			//++index_iter_;
+		size_t row_size = summary_row_.SparseSerializedSize();
+		void* row_data = buffs->AppendReserve(0, row_size);
+		if (row_data == NULL) {
+			VLOG(0) << "Failed at Summary Row";
+			return false;
 		}
-		//for (; index_iter_ != num_words_; ++index_iter_) {
-			curr_row_size_ = summary_row_.SparseSerializedSize();//SerializedSize();
-			if (curr_row_size_ > tmp_row_buff_size_) {
-				delete[] tmp_row_buff_;
-				tmp_row_buff_size_ = curr_row_size_;
-				tmp_row_buff_ = new uint8_t[curr_row_size_];
-			}
-			curr_row_size_ = summary_row_.SparseSerialize(tmp_row_buff_);//->Serialize(tmp_row_buff_);
-			bool append_row_suc = AppendRowToBuffs(client_id, buffs, tmp_row_buff_, curr_row_size_, 0);
-			if (!append_row_suc) {
-				VLOG(0) << "Failed at Summary Row";
-				return false;
-			}
-		//}
-		delete[] tmp_row_buff_;
+		CHECK_EQ(summary_row_.SparseSerialize(row_data), row_size);
 		return true;
 	}
 
-	bool ServerSummaryRow::AppendRowToBuffs(int32_t client_id,
-		petuum::RecordBuff* buffs,
-		const void* row_data, size_t row_size, int32_t row_id) {
-		int32_t bg_id = petuum::GlobalContext::get_head_bg_id(client_id);
-		bool suc = buffs->Append(row_id, row_data, row_size);
-		return suc;
-	}
-
 }
\ No newline at end of file
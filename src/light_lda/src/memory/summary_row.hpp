@@ -34,12 +34,12 @@ namespace petuum {
 
 	class ClientSummaryRow : public SummaryRow {
 	public:
-		ClientSummaryRow() {}
+		ClientSummaryRow() : send_msg_(nullptr) {}
 		ClientSummaryRow(int32_t table_id, int32_t num_topic) : 
-			SummaryRow(table_id, num_topic) {
+			SummaryRow(table_id, num_topic), send_msg_(nullptr) {
 			send_msg_data_size_ = kSendDeltaMsgSizeInit;
-			tmp_row_buff_size_ = kTmpRowBuffSizeInit;
 		}
+		~ClientSummaryRow();
 		int64_t GetSummaryCount(int32_t column_id) const {
 			CHECK_GE(summary_row_[column_id], 0);
 			return summary_row_[column_id];
@@ -55,28 +55,23 @@ namespace petuum {
 		void ClientCreateSendTableDeltaMsg(
 			ClientSendTableDeltaMsgFunc SendMsg);
 	private:
-		void InitAppendTableToBuffs();
-		bool AppendTableToBuffs(
-			petuum::RecordBuff* buffs, bool resume);
-		bool AppendRowToBuffs(
-			petuum::RecordBuff* buffs,
-			const void* row_data, size_t row_size, int32_t row_id);
+		// serializes the row straight into the send message
+		bool AppendTableToBuffs(petuum::RecordBuff* buffs);
+		void SendBuff(ClientSendTableDeltaMsgFunc SendMsg, int32_t server_id,
+			petuum::RecordBuff& record_buff, bool is_last);
 	private:
 		static const size_t kSendDeltaMsgSizeInit = 16 * 1024 * 1024;
-		static const size_t kTmpRowBuffSizeInit = 64 * 1024;
 		size_t send_msg_data_size_;
-		size_t tmp_row_buff_size_;
-		size_t curr_row_size_;
-		uint8_t* tmp_row_buff_;
+		petuum::ClientSendOpLogIterationMsg* send_msg_; // reused across clocks
 	};
 
 	class ServerSummaryRow : public SummaryRow {
 	public:
 		ServerSummaryRow(int32_t table_id, int32_t num_topic) :
-			SummaryRow(table_id, num_topic) {
+			SummaryRow(table_id, num_topic), send_msg_(nullptr) {
 			send_msg_data_size_ = kSendDeltaMsgSizeInit;
-			tmp_row_buff_size_ = kTmpRowBuffSizeInit;
 		}
+		~ServerSummaryRow();
 		void ApplyClientSendOpLogIterationMsg(ClientSendOpLogIterationMsg& msg);
 		void ApplyRowOpLog(int32_t table_id, int32_t row_id,
 			const void *data, size_t row_size);
@@ -88,19 +83,14 @@ namespace petuum {
 		void Dump(const std::string& dump_file);
 
 	private:
-		void InitAppendTableToBuffs();
-		bool AppendTableToBuffs(int32_t client_id,
-			petuum::RecordBuff* buffs, bool resume);
-		bool AppendRowToBuffs(int32_t client_id,
-			petuum::RecordBuff* buffs,
-			const void* row_data, size_t row_size, int32_t row_id);
+		// serializes the row straight into the send message
+		bool AppendTableToBuffs(petuum::RecordBuff* buffs);
+		void SendBuff(ServerPushModelSliceMsgFunc SendMsg, int32_t bg_id,
+			petuum::RecordBuff& record_buff, bool is_last);
 	private:
 		mutable std::mutex mutex_;
 		static const size_t kSendDeltaMsgSizeInit = 16 * 1024 * 1024;
-		static const size_t kTmpRowBuffSizeInit = 512;
 		size_t send_msg_data_size_;
-		size_t tmp_row_buff_size_;
-		size_t curr_row_size_;
-		uint8_t* tmp_row_buff_;
+		petuum::ServerPushOpLogIterationMsg* send_msg_; // reused across requests
 	};
 }
@@ -13,7 +13,7 @@ namespace petuum {
 
 	std::vector<pthread_t> BgWorkers::threads_;
 	std::vector<int32_t> BgWorkers::thread_ids_;
-	util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>>* BgWorkers::server_delta_queue_;
+	util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>>* BgWorkers::server_delta_queue_;
 	int32_t BgWorkers::id_st_;
 	pthread_barrier_t BgWorkers::init_barrier_;
 	CommBus *BgWorkers::comm_bus_;
@@ -102,7 +102,7 @@ namespace petuum {
 		ThreadRegister();
 	}
 
-	void BgWorkers::Init(util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue)
+	void BgWorkers::Init(util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue)
 	{
 		threads_.resize(GlobalContext::get_num_bg_threads());
 		thread_ids_.resize(GlobalContext::get_num_bg_threads());
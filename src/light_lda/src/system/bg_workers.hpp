@@ -10,7 +10,7 @@
 #include "system/system_context.hpp"
 #include "util/comm_bus.hpp"
 #include "util/vector_clock.hpp"
-#include "util/mt_queue_move.h"
+#include "util/ring_queue.h"
 
 namespace petuum {
 
@@ -22,7 +22,7 @@ class BgWorkers {
 public:
   static void Init();
 
-  static void Init(util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue);
+  static void Init(util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue);
 
   static void ShutDown();
 
@@ -53,7 +53,7 @@ private:
   static std::vector<int32_t> thread_ids_;
 
 private:
-  static util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue_;
+  static util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>> *server_delta_queue_;
 
   static int32_t id_st_;
 
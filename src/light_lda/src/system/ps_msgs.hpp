@@ -907,7 +907,8 @@ public:
 
 	size_t get_header_size() {
 		return ArbitrarySizedMsg::get_header_size() + sizeof(bool)+sizeof(int32_t)
-			+ sizeof(int32_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(bool);
+			+ sizeof(int32_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(bool)
+			+ sizeof(int32_t);
 	}
 
 	bool &get_is_clock() {
@@ -956,6 +957,15 @@ public:
 			+ ArbitrarySizedMsg::get_header_size() + sizeof(bool)
 			+sizeof(int32_t)+sizeof(int32_t)+sizeof(int32_t)+sizeof(int32_t) +sizeof(int32_t)));
 	}
+
+	// Set on iteration clock msg: number of msgs of this table the client has
+	// sent to this server so far, this one included. The delta threads send
+	// concurrently, so the clock msg may overtake some of them.
+	int32_t &get_num_table_msgs() {
+		return *(reinterpret_cast<int32_t*>(mem_.get_mem()
+			+ ArbitrarySizedMsg::get_header_size() + sizeof(bool)
+			+sizeof(int32_t)+sizeof(int32_t)+sizeof(int32_t)+sizeof(int32_t) +sizeof(int32_t) + sizeof(bool)));
+	}
 	// data is to be accessed via SerializedOpLogAccessor
 	void *get_data() {
 		return mem_.get_mem() + get_header_size();
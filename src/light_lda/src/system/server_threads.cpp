@@ -3,6 +3,8 @@
 
 
 #include "server_threads.hpp"
+#include <deque>
+#include <unordered_map>
 #include "system/system_context.hpp"
 #include "system/ps_msgs.hpp"
 #include "system/mem_transfer.hpp"
@@ -332,6 +334,10 @@ namespace petuum {
 		int32_t iter = 0;
 		std::string dump_file = GlobalContext::get_dump_file();
 		int32_t dump_iter = GlobalContext::get_dump_iter();
+		// client id -> number of word topic msgs received
+		std::unordered_map<int32_t, int32_t> num_table_msgs;
+		// client id -> msg counts the pending iteration clocks wait for
+		std::unordered_map<int32_t, std::deque<int32_t>> pending_clocks;
 		while (true)
 		{
 
@@ -347,6 +353,7 @@ namespace petuum {
 				VLOG(0) << "Update word topic table";
 				// Todo(v-feigao): add ApplyClientSendOplogMsg in LDAModelBlock
 				word_topic_table_->ApplyClientSendOpLogIterationMsg(*msg_ptr);
+				++num_table_msgs[client_id];
 				VLOG(0) << "Updata word topic successfully";
 			}
 			else if (msg_ptr->get_table_id() == GlobalContext::kSummaryRowID) {
@@ -362,7 +369,12 @@ namespace petuum {
 			VLOG(0) << "Server Aggregator apply oplog msg. Iteration = " << iteration
 				<< ". Is_iteration_clock = " << is_iteration_clock;
 
-			if (is_iteration_clock) {
+			// the clock takes effect once all msgs sent before it are applied
+			std::deque<int32_t>& pending = pending_clocks[client_id];
+			if (is_iteration_clock)
+				pending.push_back(msg_ptr->get_num_table_msgs());
+			while (!pending.empty() && num_table_msgs[client_id] >= pending.front()) {
+				pending.pop_front();
 				int32_t new_clock = client_clocks_.Tick(client_id);
 				if (new_clock) {
 					// Send ServerInit
@@ -497,6 +509,7 @@ namespace petuum {
 											  msg_ptr->get_client_id() = client_send_oplog_iteration_msg.get_client_id();
 											  msg_ptr->get_iteration() = client_send_oplog_iteration_msg.get_iteration();
 											  msg_ptr->get_is_iteration_clock() = client_send_oplog_iteration_msg.get_is_iteration_clock();
+											  msg_ptr->get_num_table_msgs() = client_send_oplog_iteration_msg.get_num_table_msgs();
 							
 											  memcpy(msg_ptr->get_data(), client_send_oplog_iteration_msg.get_data(), avai_size);
 											  VLOG(0) << "Server threads receive kClientSendOpLogIteration. iteration: " << msg_ptr->get_iteration()
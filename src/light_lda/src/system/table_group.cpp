@@ -15,7 +15,7 @@ namespace petuum {
 	VectorClockMT TableGroup::vector_clock_;
 	bool TableGroup::server_init_finish_;
 
-	util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>> TableGroup::server_delta_queue_;
+	util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>> TableGroup::server_delta_queue_;
 
 	int32_t TableGroup::Init(const TableGroupConfig &table_group_config,
 		bool table_access) {
@@ -31,17 +31,14 @@ namespace petuum {
 
 		// NOTE(jiyuan): hack here, we assume the num_local_table_threads 
 		// to be the number of threads which need to communicat with bg_worker.
-		// in our case, only ModelIOThread and DeltaIOThread need to connect to
+		// in our case, only ModelIOThread and DeltaIOThreads need to connect to
 		// bg_worker
-		// 2 + 1, plus the Init main thread
-		int32_t num_local_table_threads = 3;
-		int32_t num_local_io_threads = 2;
-        pthread_barrier_init(&register_barrier_, NULL, 2);
 		// NOTE(v-feigao): modified to allowing multiple delta io threads.
 		// num_delta_threads * DeltaIOThread + 1 ModelIOThread
 		// plus 1 the Init main thread
-		//int32_t num_local_io_threads = table_group_config.num_delta_threads + 1;
-		//int32_t num_local_table_threads = num_local_io_threads + 1;
+		int32_t num_local_io_threads = table_group_config.num_delta_threads + 1;
+		int32_t num_local_table_threads = num_local_io_threads + 1;
+		pthread_barrier_init(&register_barrier_, NULL, num_local_io_threads);
 
 		int32_t num_local_bg_threads = table_group_config.num_local_bg_threads;
 		int32_t num_total_bg_threads = table_group_config.num_total_bg_threads;
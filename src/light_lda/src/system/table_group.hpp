@@ -11,7 +11,7 @@
 #include "system/ps_msgs.hpp"
 #include "system/configs.hpp"
 #include "system/abstract_row.hpp"
-#include "util/mt_queue_move.h"
+#include "util/ring_queue.h"
 #include "util/vector_clock_mt.hpp"
 
 namespace petuum {
@@ -47,7 +47,7 @@ namespace petuum {
 		// this function.
 		static void WaitThreadRegister();
 
-		static util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>>* GetServerDeltaQueue()
+		static util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>>* GetServerDeltaQueue()
 		{
 			return &server_delta_queue_;
 		}
@@ -80,7 +80,7 @@ namespace petuum {
 
 		// NOTE(jiyuan): for communication between bg_worker and ModelIOThread
 
-		static util::MtQueueMove<std::unique_ptr<ServerPushOpLogIterationMsg>> server_delta_queue_;
+		static util::SpscRingQueue<std::unique_ptr<ServerPushOpLogIterationMsg>> server_delta_queue_;
 		static VectorClockMT app_vector_clock_;
 		static bool server_init_finish_;
 
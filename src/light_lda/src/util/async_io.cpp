@@ -0,0 +1,79 @@
+#include "util/async_io.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <glog/logging.h>
+
+namespace util {
+	void AsyncIO::IOBatch::Add() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		++pending_;
+	}
+
+	void AsyncIO::IOBatch::Done(int64_t bytes, int error) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		bytes_ += bytes;
+		if (error != 0 && error_ == 0) error_ = error;
+		if (--pending_ == 0) condition_.notify_all();
+	}
+
+	void AsyncIO::IOBatch::Wait() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		condition_.wait(lock, [this]() { return pending_ == 0; });
+	}
+
+	AsyncIO::AsyncIO(int32_t num_threads, int64_t chunk_size) : chunk_size_(chunk_size) {
+		CHECK_GT(num_threads, 0);
+		CHECK_GT(chunk_size, 0);
+		threads_.resize(num_threads);
+		for (auto& thread : threads_)
+			thread = std::thread(&AsyncIO::ThreadFunc, this);
+	}
+
+	AsyncIO::~AsyncIO() {
+		queue_.Exit();
+		for (auto& thread : threads_)
+			thread.join();
+	}
+
+	void AsyncIO::Read(int fd, char* buffer, int64_t size, int64_t offset, IOBatch* batch) {
+		Submit(false, fd, buffer, size, offset, batch);
+	}
+
+	void AsyncIO::Write(int fd, const char* buffer, int64_t size, int64_t offset, IOBatch* batch) {
+		Submit(true, fd, const_cast<char*>(buffer), size, offset, batch);
+	}
+
+	void AsyncIO::Submit(bool write, int fd, char* buffer, int64_t size, int64_t offset, IOBatch* batch) {
+		for (int64_t begin = 0; begin < size; begin += chunk_size_) {
+			Request request = { write, fd, buffer + begin,
+				(std::min)(chunk_size_, size - begin), offset + begin, batch };
+			batch->Add();
+			queue_.Push(request);
+		}
+	}
+
+	void AsyncIO::ThreadFunc() {
+		Request request;
+		while (queue_.Pop(request)) {
+			int64_t done = 0;
+			int error = 0;
+			while (done < request.size) {
+				ssize_t bytes = request.write ?
+					pwrite(request.fd, request.buffer + done, request.size - done, request.offset + done) :
+					pread(request.fd, request.buffer + done, request.size - done, request.offset + done);
+				if (bytes < 0) {
+					if (errno == EINTR) continue;
+					error = errno;
+					break;
+				}
+				done += bytes;
+				// a short read of a regular file means end of file, do not
+				// retry at an offset O_DIRECT would refuse
+				if (!request.write && done < request.size) break;
+				if (bytes == 0) break;
+			}
+			request.batch->Done(done, error);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "util/mt_queue_move.h"
+
+namespace util {
+	// Pool of IO threads running pread/pwrite requests split in chunks, so
+	// that several chunks of a file are in flight at a time. Requests are
+	// grouped in an IOBatch the caller waits on.
+	class AsyncIO {
+	public:
+		class IOBatch {
+		public:
+			IOBatch() : pending_(0), bytes_(0), error_(0) {}
+
+			// Blocks until all the chunks of the batch are done.
+			void Wait();
+
+			// Number of bytes transferred, valid after Wait. Reads stop at the
+			// end of file.
+			int64_t Bytes() const { return bytes_; }
+
+			// errno of the first failed chunk, 0 if all succeeded
+			int Error() const { return error_; }
+
+			void Reset() { bytes_ = 0; error_ = 0; }
+
+		private:
+			friend class AsyncIO;
+			void Add();
+			void Done(int64_t bytes, int error);
+
+			std::mutex mutex_;
+			std::condition_variable condition_;
+			int32_t pending_;
+			int64_t bytes_;
+			int error_;
+		};
+
+		// chunk_size should be a multiple of the O_DIRECT alignment if the
+		// files are opened with O_DIRECT.
+		AsyncIO(int32_t num_threads, int64_t chunk_size);
+		~AsyncIO();
+
+		// Reads |size| bytes at |offset| of |fd| into |buffer|. Returns right
+		// away, |buffer| must be kept until batch->Wait() returns.
+		void Read(int fd, char* buffer, int64_t size, int64_t offset, IOBatch* batch);
+
+		// Same as Read, for writing |buffer|.
+		void Write(int fd, const char* buffer, int64_t size, int64_t offset, IOBatch* batch);
+
+	private:
+		struct Request {
+			bool write;
+			int fd;
+			char* buffer;
+			int64_t size;
+			int64_t offset;
+			IOBatch* batch;
+		};
+
+		void Submit(bool write, int fd, char* buffer, int64_t size, int64_t offset, IOBatch* batch);
+		void ThreadFunc();
+
+		int64_t chunk_size_;
+		MtQueueMove<Request> queue_;
+		std::vector<std::thread> threads_;
+
+		AsyncIO(const AsyncIO&);
+		void operator=(const AsyncIO&);
+	};
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <glog/logging.h>
+
+#include "util/delta_table.h"
+
+namespace petuum {
+
+	// Worker side accumulator of word-topic deltas of one delta shard.
+	// Updates on the same (word, topic) are combined in place, so the +1/-1
+	// pairs produced when topics move back and forth cancel out before they
+	// reach the delta queue. FlushTo emits the non-zero entries sorted by word.
+	class DeltaAggregator {
+	public:
+		// Half of a DeltaArray, keeps the hash table at 2M slots (24MB).
+		static const int32_t kDefaultMaxEntries = 0x180000;
+
+		explicit DeltaAggregator(int32_t max_entries = kDefaultMaxEntries, 
+			int32_t init_capacity = 1024) :
+			max_entries_(max_entries), num_entries_(0),
+			num_updates_(0), num_flushed_(0)
+		{
+			int32_t capacity = 1;
+			while (capacity < init_capacity) capacity <<= 1;
+			Resize(capacity);
+		}
+
+		inline void Update(int32_t word_id, int32_t topic_id, int32_t delta) {
+			++num_updates_;
+			int64_t key = (static_cast<int64_t>(word_id) << 32) | static_cast<uint32_t>(topic_id);
+			int32_t pos = Hash(key);
+			while (keys_[pos] != kEmptyKey) {
+				if (keys_[pos] == key) {
+					deltas_[pos] += delta;
+					return;
+				}
+				pos = (pos + 1) & mask_;
+			}
+			keys_[pos] = key;
+			deltas_[pos] = delta;
+			if (++num_entries_ * 4 > static_cast<int64_t>(keys_.size()) * 3)
+				Resize(static_cast<int32_t>(keys_.size()) * 2);
+		}
+
+		// Every token of a doc adds at most two new entries.
+		inline bool ValidDocSize(int32_t doc_size) const {
+			return doc_size * 2 < max_entries_ - num_entries_;
+		}
+
+		inline bool Empty() const { return num_entries_ == 0; }
+
+		// Moves the non-zero entries into delta_array and resets the accumulator.
+		// Returns the number of entries written.
+		int32_t FlushTo(DeltaArray& delta_array) {
+			int32_t begin = delta_array.index_;
+			for (size_t pos = 0; num_entries_ != 0 && pos < keys_.size(); ++pos) {
+				if (keys_[pos] == kEmptyKey) continue;
+				if (deltas_[pos] != 0) {
+					delta_array.Update(static_cast<int32_t>(keys_[pos] >> 32),
+						static_cast<int32_t>(keys_[pos] & 0xFFFFFFFF), deltas_[pos]);
+				}
+				keys_[pos] = kEmptyKey;
+				--num_entries_;
+			}
+			CHECK_EQ(num_entries_, 0);
+			std::sort(delta_array.array_ + begin, delta_array.array_ + delta_array.index_,
+				[](const DeltaArray::Delta& lhs, const DeltaArray::Delta& rhs) {
+				return lhs.word_id < rhs.word_id ||
+					(lhs.word_id == rhs.word_id && lhs.topic_id < rhs.topic_id);
+			});
+			int32_t num_flushed = delta_array.index_ - begin;
+			num_flushed_ += num_flushed;
+			return num_flushed;
+		}
+
+		// Number of raw updates and of entries actually emitted since the last call.
+		void GetStatistics(int64_t& num_updates, int64_t& num_flushed) {
+			num_updates = num_updates_;
+			num_flushed = num_flushed_;
+			num_updates_ = 0;
+			num_flushed_ = 0;
+		}
+
+	private:
+		inline int32_t Hash(int64_t key) const {
+			return static_cast<int32_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> shift_);
+		}
+
+		void Resize(int32_t capacity) {
+			std::vector<int64_t> old_keys(capacity, static_cast<int64_t>(kEmptyKey));
+			std::vector<int32_t> old_deltas(capacity, 0);
+			old_keys.swap(keys_);
+			old_deltas.swap(deltas_);
+			mask_ = capacity - 1;
+			shift_ = 64;
+			while (capacity > 1) { capacity >>= 1; --shift_; }
+
+			for (size_t i = 0; i < old_keys.size(); ++i) {
+				if (old_keys[i] == kEmptyKey) continue;
+				int32_t pos = Hash(old_keys[i]);
+				while (keys_[pos] != kEmptyKey) pos = (pos + 1) & mask_;
+				keys_[pos] = old_keys[i];
+				deltas_[pos] = old_deltas[i];
+			}
+		}
+
+	private:
+		static const int64_t kEmptyKey = -1;
+
+		std::vector<int64_t> keys_;
+		std::vector<int32_t> deltas_;
+		int32_t mask_;
+		int32_t shift_;
+
+		int32_t max_entries_;
+		int32_t num_entries_;
+
+		int64_t num_updates_;
+		int64_t num_flushed_;
+
+		DeltaAggregator(const DeltaAggregator&);
+		void operator=(const DeltaAggregator&);
+	};
+}
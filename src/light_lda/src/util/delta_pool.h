@@ -3,24 +3,63 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
 #include "util/delta_table.h"
-#include "util/mt_queue_move.h"
+#include "util/ring_queue.h"
 
 namespace petuum {
+	// Free list of preallocated deltas. The pool starts with |min_count| items
+	// and, when Allocate finds it empty, grows up to |max_count| items instead
+	// of blocking. Shrink releases the idle items that were not needed since
+	// the previous call. min_count == max_count gives a fixed pool.
 	template <typename Delta>
 	class DeltaPool {
 	public:
-		DeltaPool(){}
+		DeltaPool() : min_count_(0), max_count_(0), num_allocated_(0), num_in_use_(0),
+			high_water_in_use_(0), recent_high_water_in_use_(0), high_water_allocated_(0), num_grow_(0), num_shrink_(0),
+			item_size_(0) {}
 		~DeltaPool(){}
 		void Init(int32_t capacity = 1024);
 
+		void Init(int32_t min_count, int32_t max_count, std::function<Delta*()> creator);
+
 		void Allocate(std::unique_ptr<Delta>& delta_array);
 
 		void Free(std::unique_ptr<Delta>& delta_array);
+
+		// Releases idle items above (min_count, high-water in use since last call).
+		void Shrink();
+
+		int32_t MaxCount() const { return max_count_; }
+
+		// Seconds spent blocked in Allocate on an empty pool.
+		double AllocateWaitTime() const { return delta_pool_->PopWaitTime(); }
+		void ResetWaitTime() { delta_pool_->ResetWaitTime(); }
+
+		// Logs pool size, high-water marks and blocked time, then resets the
+		// blocked time.
+		void LogStats(const std::string& name);
 	private:
+		Delta* CreateNew();
 		void AllocateNew();
+		void UpdateHighWater(std::atomic<int32_t>& high_water, int32_t value);
 	private:
-		util::MtQueueMove<std::unique_ptr<Delta>> delta_pool_;
+		std::unique_ptr<util::RingQueue<std::unique_ptr<Delta>>> delta_pool_;
+		std::function<Delta*()> creator_;
+
+		int32_t min_count_;
+		int32_t max_count_;
+		std::atomic<int32_t> num_allocated_;
+		std::atomic<int32_t> num_in_use_;
+		std::atomic<int32_t> high_water_in_use_;
+		std::atomic<int32_t> recent_high_water_in_use_;
+		std::atomic<int32_t> high_water_allocated_;
+		std::atomic<int32_t> num_grow_;
+		std::atomic<int32_t> num_shrink_;
+		int64_t item_size_;
 
 		DeltaPool(const DeltaPool&);
 		void operator=(const DeltaPool&);
@@ -30,34 +69,112 @@ namespace petuum {
 	inline void DeltaPool<Delta>::Allocate(
 		std::unique_ptr<Delta>& delta_array) {
         //LOG(INFO)<<"delta_pool starts";
-		delta_pool_.Pop(delta_array);
+		if (!delta_pool_->TryPop(delta_array)) {
+			int32_t num_allocated = num_allocated_.load();
+			while (num_allocated < max_count_ &&
+				!num_allocated_.compare_exchange_weak(num_allocated, num_allocated + 1));
+			if (num_allocated < max_count_) {
+				delta_array.reset(CreateNew());
+				++num_grow_;
+				UpdateHighWater(high_water_allocated_, num_allocated + 1);
+			}
+			else {
+				delta_pool_->Pop(delta_array);
+			}
+		}
+		int32_t num_in_use = ++num_in_use_;
+		UpdateHighWater(high_water_in_use_, num_in_use);
+		UpdateHighWater(recent_high_water_in_use_, num_in_use);
         //LOG(INFO)<<"delta_pool ends";
 		return;
 	}
 
 	template <typename Delta>
 	inline void DeltaPool<Delta>::Free(std::unique_ptr<Delta>& delta_array) {
+		--num_in_use_;
 		delta_array->Clear();
-		delta_pool_.Push(delta_array);
+		delta_pool_->Push(delta_array);
+	}
+
+	template <typename Delta>
+	void DeltaPool<Delta>::Shrink() {
+		int32_t keep = (std::max)(min_count_, recent_high_water_in_use_.load());
+		recent_high_water_in_use_ = num_in_use_.load();
+		int32_t num_allocated = num_allocated_.load();
+		while (num_allocated > keep) {
+			if (!num_allocated_.compare_exchange_weak(num_allocated, num_allocated - 1))
+				continue;
+			std::unique_ptr<Delta> delta_array;
+			if (!delta_pool_->TryPop(delta_array)) {
+				++num_allocated_;
+				break;
+			}
+			++num_shrink_;
+			--num_allocated;
+		}
 	}
 
 	template <typename Delta>
 	void DeltaPool<Delta>::Init(int32_t capacity) {
-		for (int32_t i = 0; i < capacity; ++i) {
+		Init(capacity, capacity, []() { return new Delta; });
+	}
+
+	template <typename Delta>
+	void DeltaPool<Delta>::Init(int32_t min_count, int32_t max_count,
+		std::function<Delta*()> creator) {
+		CHECK_GT(min_count, 0);
+		CHECK_LE(min_count, max_count);
+		min_count_ = min_count;
+		max_count_ = max_count;
+		creator_ = creator;
+		delta_pool_.reset(new util::RingQueue<std::unique_ptr<Delta>>(max_count));
+		for (int32_t i = 0; i < min_count; ++i) {
 			AllocateNew();
 		}
+		num_allocated_ = min_count;
+		high_water_allocated_ = min_count;
 	}
 
 	template <typename Delta>
-	void DeltaPool<Delta>::AllocateNew() {
-		std::unique_ptr<Delta> delta_array;
+	void DeltaPool<Delta>::LogStats(const std::string& name) {
+		const double kMB = 1024.0 * 1024.0;
+		LOG(INFO) << name << " pool: allocated = " << num_allocated_
+			<< " (" << num_allocated_ * item_size_ / kMB << " MB)"
+			<< "\tin use = " << num_in_use_
+			<< "\thigh-water in use = " << high_water_in_use_
+			<< "\thigh-water allocated = " << high_water_allocated_
+			<< " (" << high_water_allocated_ * item_size_ / kMB << " MB)"
+			<< "\tmax = " << max_count_
+			<< "\tgrow = " << num_grow_ << "\tshrink = " << num_shrink_
+			<< "\tblocked time = " << AllocateWaitTime();
+		num_grow_ = 0;
+		num_shrink_ = 0;
+		ResetWaitTime();
+	}
+
+	template <typename Delta>
+	Delta* DeltaPool<Delta>::CreateNew() {
+		Delta* delta_array = nullptr;
 		try {
-			delta_array.reset(new Delta);
+			delta_array = creator_();
 		}
 		catch (std::bad_alloc& ba) {
 			LOG(FATAL) << "Bad Alloc caught: " << ba.what();
 		}
+		return delta_array;
+	}
+
+	template <typename Delta>
+	void DeltaPool<Delta>::AllocateNew() {
+		std::unique_ptr<Delta> delta_array(CreateNew());
+		item_size_ = delta_array->MemorySize();
 		//delta_pool_.Push(std::move(delta_array));
-		delta_pool_.Push(delta_array);
+		delta_pool_->Push(delta_array);
+	}
+
+	template <typename Delta>
+	void DeltaPool<Delta>::UpdateHighWater(std::atomic<int32_t>& high_water, int32_t value) {
+		int32_t curr = high_water.load();
+		while (value > curr && !high_water.compare_exchange_weak(curr, value));
 	}
 }
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <utility>
 #include <vector>
 #include <unordered_map>
@@ -33,6 +34,21 @@ namespace petuum {
 			memset(delta_, 0, sizeof(int32_t)* K_);
 		}
 
+		int64_t MemorySize() const { return sizeof(int32_t) * static_cast<int64_t>(K_); }
+
+		// Adds topics [topic_begin, topic_end) of deltas to this one and clears
+		// them in deltas.
+		void ReduceFrom(std::vector<std::unique_ptr<SummaryDelta>>& deltas,
+			int32_t topic_begin, int32_t topic_end) {
+			for (auto& other : deltas) {
+				int32_t* other_delta = other->delta_;
+				for (int32_t k = topic_begin; k < topic_end; ++k) {
+					delta_[k] += other_delta[k];
+					other_delta[k] = 0;
+				}
+			}
+		}
+
 	private:
 		int32_t K_;
 		int32_t* delta_;
@@ -50,14 +66,17 @@ namespace petuum {
 			int32_t delta;
 		};
 
-		const int32_t kReserveSize = 0x300000; // sizeof(Delta) = 12B. 12B * 3M = 36MB
+		static const int32_t kDefaultReserveSize = 0x300000; // sizeof(Delta) = 12B. 12B * 3M = 36MB
+		const int32_t kReserveSize;
 
-		DeltaArray() :index_(0), is_clock_(false) {
+		explicit DeltaArray(int32_t reserve_size = kDefaultReserveSize) :
+			kReserveSize(reserve_size), index_(0), is_clock_(false) {
 			array_ = new Delta[kReserveSize];
 		}
 
-		DeltaArray(int32_t table_id, int32_t iteration = -1) :
-			index_(0), is_clock_(false), table_id_(table_id), iteration_(iteration)
+		DeltaArray(int32_t table_id, int32_t iteration) :
+			kReserveSize(kDefaultReserveSize), index_(0), is_clock_(false), 
+			table_id_(table_id), iteration_(iteration)
 		{
 			array_ = new Delta[kReserveSize];
 		}
@@ -108,8 +127,10 @@ namespace petuum {
 
 		inline bool ValidDocSize(int32_t doc_size) { return doc_size * 2 < kReserveSize - index_; }
 
+		int64_t MemorySize() const { return sizeof(Delta) * static_cast<int64_t>(kReserveSize); }
+
 		inline void Update(int32_t word_id, int32_t topic_id, int32_t delta) {
-			CHECK_LE(index_, kReserveSize);
+			CHECK_LT(index_, kReserveSize);
 			array_[index_].word_id = word_id;
 			array_[index_].topic_id = topic_id;
 			array_[index_].delta = delta;
@@ -237,6 +237,9 @@ namespace lda
 
 		bool is_dense() { return is_dense_ == 1; }
 
+		// rows are rehashed in the buffer of the thread that updates them
+		inline void set_rehash_buf(int32_t* external_rehash_buf) { external_rehash_buf_ = external_rehash_buf; }
+
 		int32_t capacity() { return capacity_; }
 
 		int32_t* memory() { return memory_; }
@@ -55,6 +55,22 @@ public:
     return true;
   }
 
+  // Same as Append, but returns where the record_size bytes of the record
+  // are to be written instead of copying them, so that a row can serialize
+  // itself straight into the buffer. Returns NULL if the record does not fit.
+  void *AppendReserve(int32_t record_id, size_t record_size) {
+    if (offset_ + sizeof(int32_t) + record_size + sizeof(size_t) > mem_size_) {
+      return NULL;
+    }
+    *(reinterpret_cast<int32_t*>(mem_ + offset_)) = record_id;
+    offset_ += sizeof(int32_t);
+    *(reinterpret_cast<size_t*>(mem_ + offset_)) = record_size;
+    offset_ += sizeof(size_t);
+    void *record = mem_ + offset_;
+    offset_ += record_size;
+    return record;
+  }
+
   size_t GetMemUsedSize() {
     return offset_;
   }
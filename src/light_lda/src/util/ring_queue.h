@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace util {
+	// Wait policy of the ring queues: spin on the condition for a while, then
+	// yield, and finally park on a condition variable. spin_count = 0 parks
+	// right away. The time spent waiting is accumulated for profiling.
+	class SpinThenPark {
+	public:
+		explicit SpinThenPark(int32_t spin_count) :
+			spin_count_(spin_count), num_parked_(0), wait_ns_(0) {}
+
+		// Blocks until |ready| returns true. |ready| may have side effects,
+		// e.g. a TryPush that succeeds.
+		template <typename Pred>
+		void Wait(Pred ready) {
+			if (ready()) return;
+			auto begin = std::chrono::steady_clock::now();
+			bool done = false;
+			for (int32_t i = 0; i < spin_count_ && !done; ++i) {
+				if (i >= spin_count_ / 2) std::this_thread::yield();
+				done = ready();
+			}
+			if (!done) {
+				std::unique_lock<std::mutex> lock(mutex_);
+				++num_parked_;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				condition_.wait(lock, ready);
+				--num_parked_;
+			}
+			wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - begin).count();
+		}
+
+		// Called after the state |ready| depends on has changed.
+		inline void Notify() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (num_parked_.load(std::memory_order_relaxed) > 0) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				condition_.notify_all();
+			}
+		}
+
+		void NotifyAll() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			condition_.notify_all();
+		}
+
+		double WaitTime() const { return wait_ns_.load() * 1e-9; }
+
+		void ResetWaitTime() { wait_ns_ = 0; }
+
+	private:
+		int32_t spin_count_;
+		std::atomic<int32_t> num_parked_;
+		std::atomic<int64_t> wait_ns_;
+		std::mutex mutex_;
+		std::condition_variable condition_;
+	};
+
+	const size_t kRingQueueDefaultCapacity = 4096;
+	const int32_t kRingQueueDefaultSpinCount = 1024;
+
+	inline size_t RoundUpPowerOfTwo(size_t n) {
+		size_t capacity = 2;
+		while (capacity < n) capacity <<= 1;
+		return capacity;
+	}
+
+	// Bounded lock-free ring buffer queue (D. Vyukov's design). Any number of
+	// producers and consumers may use it, it is meant for the many-workers to
+	// one-delta-thread pipelines and for the DeltaPool free list.
+	// Same interface as MtQueueMove, except Push blocks when the queue is full.
+	template<typename T>
+	class RingQueue {
+	public:
+		explicit RingQueue(size_t capacity = kRingQueueDefaultCapacity,
+			int32_t spin_count = kRingQueueDefaultSpinCount) :
+			not_empty_(spin_count), not_full_(spin_count), exit_(false)
+		{
+			capacity_ = RoundUpPowerOfTwo(capacity);
+			mask_ = capacity_ - 1;
+			buffer_.reset(new Cell[capacity_]);
+			for (size_t i = 0; i < capacity_; ++i)
+				buffer_[i].sequence.store(i, std::memory_order_relaxed);
+			enqueue_pos_.store(0, std::memory_order_relaxed);
+			dequeue_pos_.store(0, std::memory_order_relaxed);
+		}
+		~RingQueue() {}
+
+		// IMPORTANT: after push |item| in the queue, the variable |item| is still valid but uninitialized
+		void Push(T& item) {
+			not_full_.Wait([&]() { return TryPush(item); });
+			not_empty_.Notify();
+		}
+
+		bool Pop(T& result) {
+			bool popped = false;
+			not_empty_.Wait([&]() {
+				popped = TryPopImpl(result);
+				return popped || exit_.load();
+			});
+			if (popped) not_full_.Notify();
+			return popped;
+		}
+
+		bool TryPop(T& result) {
+			if (!TryPopImpl(result)) return false;
+			not_full_.Notify();
+			return true;
+		}
+
+		size_t Size() const {
+			size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+			size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+			return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+		}
+
+		bool Empty() const { return Size() == 0; }
+
+		size_t Capacity() const { return capacity_; }
+
+		void Exit() {
+			exit_ = true;
+			not_empty_.NotifyAll();
+		}
+
+		// Seconds producers spent blocked on a full queue and consumers spent
+		// blocked on an empty one.
+		double PushWaitTime() const { return not_full_.WaitTime(); }
+		double PopWaitTime() const { return not_empty_.WaitTime(); }
+		void ResetWaitTime() { not_full_.ResetWaitTime(); not_empty_.ResetWaitTime(); }
+
+	private:
+		bool TryPush(T& item) {
+			Cell* cell;
+			size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+			while (true) {
+				cell = &buffer_[pos & mask_];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = enqueue_pos_.load(std::memory_order_relaxed);
+				}
+			}
+			cell->data = std::move(item);
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool TryPopImpl(T& result) {
+			Cell* cell;
+			size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+			while (true) {
+				cell = &buffer_[pos & mask_];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = dequeue_pos_.load(std::memory_order_relaxed);
+				}
+			}
+			result = std::move(cell->data);
+			cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		static const size_t kCacheLineSize = 64;
+
+		std::unique_ptr<Cell[]> buffer_;
+		size_t capacity_;
+		size_t mask_;
+		char pad0_[kCacheLineSize];
+		std::atomic<size_t> enqueue_pos_;
+		char pad1_[kCacheLineSize];
+		std::atomic<size_t> dequeue_pos_;
+		char pad2_[kCacheLineSize];
+
+		SpinThenPark not_empty_;
+		SpinThenPark not_full_;
+		std::atomic_bool exit_;
+
+		RingQueue(const RingQueue&);
+		void operator=(const RingQueue&);
+	};
+
+	// Bounded single-producer single-consumer ring buffer queue, e.g. bg worker
+	// to ModelIO thread. Same interface as RingQueue.
+	template<typename T>
+	class SpscRingQueue {
+	public:
+		explicit SpscRingQueue(size_t capacity = kRingQueueDefaultCapacity,
+			int32_t spin_count = kRingQueueDefaultSpinCount) :
+			head_(0), tail_cache_(0), tail_(0), head_cache_(0),
+			not_empty_(spin_count), not_full_(spin_count), exit_(false)
+		{
+			capacity_ = RoundUpPowerOfTwo(capacity);
+			mask_ = capacity_ - 1;
+			buffer_.reset(new T[capacity_]);
+		}
+		~SpscRingQueue() {}
+
+		// IMPORTANT: after push |item| in the queue, the variable |item| is still valid but uninitialized
+		void Push(T& item) {
+			not_full_.Wait([&]() { return TryPush(item); });
+			not_empty_.Notify();
+		}
+
+		bool Pop(T& result) {
+			bool popped = false;
+			not_empty_.Wait([&]() {
+				popped = TryPopImpl(result);
+				return popped || exit_.load();
+			});
+			if (popped) not_full_.Notify();
+			return popped;
+		}
+
+		bool TryPop(T& result) {
+			if (!TryPopImpl(result)) return false;
+			not_full_.Notify();
+			return true;
+		}
+
+		size_t Size() const {
+			return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+		}
+
+		bool Empty() const { return Size() == 0; }
+
+		size_t Capacity() const { return capacity_; }
+
+		void Exit() {
+			exit_ = true;
+			not_empty_.NotifyAll();
+		}
+
+		double PushWaitTime() const { return not_full_.WaitTime(); }
+		double PopWaitTime() const { return not_empty_.WaitTime(); }
+		void ResetWaitTime() { not_full_.ResetWaitTime(); not_empty_.ResetWaitTime(); }
+
+	private:
+		bool TryPush(T& item) {
+			size_t tail = tail_.load(std::memory_order_relaxed);
+			if (tail - head_cache_ == capacity_) {
+				head_cache_ = head_.load(std::memory_order_acquire);
+				if (tail - head_cache_ == capacity_) return false;
+			}
+			buffer_[tail & mask_] = std::move(item);
+			tail_.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool TryPopImpl(T& result) {
+			size_t head = head_.load(std::memory_order_relaxed);
+			if (head == tail_cache_) {
+				tail_cache_ = tail_.load(std::memory_order_acquire);
+				if (head == tail_cache_) return false;
+			}
+			result = std::move(buffer_[head & mask_]);
+			head_.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		static const size_t kCacheLineSize = 64;
+
+		std::unique_ptr<T[]> buffer_;
+		size_t capacity_;
+		size_t mask_;
+		char pad0_[kCacheLineSize];
+		// consumer side
+		std::atomic<size_t> head_;
+		size_t tail_cache_;
+		char pad1_[kCacheLineSize];
+		// producer side
+		std::atomic<size_t> tail_;
+		size_t head_cache_;
+		char pad2_[kCacheLineSize];
+
+		SpinThenPark not_empty_;
+		SpinThenPark not_full_;
+		std::atomic_bool exit_;
+
+		SpscRingQueue(const SpscRingQueue&);
+		void operator=(const SpscRingQueue&);
+	};
+}
@@ -0,0 +1,119 @@
+// Microbenchmark of the queues used between worker, delta and IO threads.
+// Producers push item pointers taken from a pool, the consumer pops and
+// returns them to the pool, the same pattern as DeltaPool + delta queue.
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include "util/mt_queue_move.h"
+#include "util/ring_queue.h"
+
+DEFINE_int32(num_producers, 4, "number of producer threads, 1 also runs the SPSC queue");
+DEFINE_int64(num_items, 10000000, "number of items pushed by all producers");
+DEFINE_int32(capacity, 1024, "capacity of the bounded queues and of the item pool");
+DEFINE_int32(spin_count, 1024, "spin count of the ring queues before parking");
+
+struct Item {
+	int64_t payload[4];
+};
+
+// Returns the seconds spent moving FLAGS_num_items items through |queue|.
+template <typename WorkQueue, typename PoolQueue>
+double Run(WorkQueue& queue, PoolQueue& pool, int32_t num_producers)
+{
+	int64_t items_per_producer = FLAGS_num_items / num_producers;
+	int64_t total_items = items_per_producer * num_producers;
+
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<std::thread> producers;
+	for (int32_t p = 0; p < num_producers; ++p)
+	{
+		producers.push_back(std::thread([&queue, &pool, items_per_producer, p]() {
+			for (int64_t i = 0; i < items_per_producer; ++i)
+			{
+				std::unique_ptr<Item> item;
+				pool.Pop(item);
+				item->payload[0] = p;
+				item->payload[1] = i;
+				queue.Push(item);
+			}
+		}));
+	}
+
+	int64_t checksum = 0;
+	for (int64_t i = 0; i < total_items; ++i)
+	{
+		std::unique_ptr<Item> item;
+		CHECK(queue.Pop(item));
+		checksum += item->payload[1];
+		pool.Push(item);
+	}
+	for (auto& thread : producers) thread.join();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	int64_t expected = num_producers * (items_per_producer * (items_per_producer - 1) / 2);
+	CHECK_EQ(checksum, expected);
+	return elapsed;
+}
+
+template <typename PoolQueue>
+void FillPool(PoolQueue& pool)
+{
+	for (int32_t i = 0; i < FLAGS_capacity; ++i)
+	{
+		std::unique_ptr<Item> item(new Item);
+		pool.Push(item);
+	}
+}
+
+void Report(const std::string& name, double elapsed)
+{
+	LOG(INFO) << name << ": " << elapsed << " seconds, "
+		<< FLAGS_num_items / elapsed / 1e6 << " M items/sec, "
+		<< elapsed * 1e9 / FLAGS_num_items << " ns/item";
+}
+
+int main(int argc, char* argv[])
+{
+	google::ParseCommandLineFlags(&argc, &argv, true);
+	google::InitGoogleLogging(argv[0]);
+	FLAGS_logtostderr = true;
+
+	LOG(INFO) << "num_producers = " << FLAGS_num_producers << " num_items = " << FLAGS_num_items
+		<< " capacity = " << FLAGS_capacity << " spin_count = " << FLAGS_spin_count;
+	{
+		util::MtQueueMove<std::unique_ptr<Item>> queue;
+		util::MtQueueMove<std::unique_ptr<Item>> pool;
+		FillPool(pool);
+		Report("MtQueueMove", Run(queue, pool, FLAGS_num_producers));
+	}
+	{
+		util::RingQueue<std::unique_ptr<Item>> queue(FLAGS_capacity, 0);
+		util::RingQueue<std::unique_ptr<Item>> pool(FLAGS_capacity, 0);
+		FillPool(pool);
+		Report("RingQueue park", Run(queue, pool, FLAGS_num_producers));
+		LOG(INFO) << "  push wait = " << queue.PushWaitTime() << " pop wait = " << queue.PopWaitTime()
+			<< " pool wait = " << pool.PopWaitTime();
+	}
+	{
+		util::RingQueue<std::unique_ptr<Item>> queue(FLAGS_capacity, FLAGS_spin_count);
+		util::RingQueue<std::unique_ptr<Item>> pool(FLAGS_capacity, FLAGS_spin_count);
+		FillPool(pool);
+		Report("RingQueue spin-then-park", Run(queue, pool, FLAGS_num_producers));
+		LOG(INFO) << "  push wait = " << queue.PushWaitTime() << " pop wait = " << queue.PopWaitTime()
+			<< " pool wait = " << pool.PopWaitTime();
+	}
+	if (FLAGS_num_producers == 1)
+	{
+		util::SpscRingQueue<std::unique_ptr<Item>> queue(FLAGS_capacity, FLAGS_spin_count);
+		util::SpscRingQueue<std::unique_ptr<Item>> pool(FLAGS_capacity, FLAGS_spin_count);
+		FillPool(pool);
+		Report("SpscRingQueue spin-then-park", Run(queue, pool, 1));
+	}
+	return 0;
+}
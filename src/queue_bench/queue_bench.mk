@@ -0,0 +1,21 @@
+# Makefile for the queue microbenchmark
+QUEUE_BENCH_SRC = $(wildcard $(QUEUE_BENCH)/*.cpp)
+QUEUE_BENCH_HDR = $(LIGHT_LDA)/src/util/mt_queue_move.h $(LIGHT_LDA)/src/util/ring_queue.h
+QUEUE_BENCH_OBJ = $(QUEUE_BENCH_SRC:.cpp=.o)
+
+queue_bench_all: queue_bench
+
+queue_bench: $(QUEUE_BENCH_BIN)/queue_bench
+
+$(QUEUE_BENCH_BIN)/queue_bench: $(QUEUE_BENCH_OBJ) $(QUEUE_BENCH_BIN)
+	$(LDA_CXX) $(LDA_CXXFLAGS) $(LDA_INCFLAGS) \
+	$(QUEUE_BENCH_OBJ) $(LDA_LDFLAGS) -o $@
+
+$(QUEUE_BENCH_OBJ): %.o: %.cpp $(QUEUE_BENCH_HDR)
+	$(LDA_CXX) $(LDA_CXXFLAGS) $(LDA_INCFLAGS) -I$(LIGHT_LDA)/src -c $< -o $@
+
+queue_bench_clean:
+	rm -rf $(QUEUE_BENCH_OBJ)
+	rm -rf $(queue_bench)
+
+.PHONY: queue_bench_clean queue_bench